@@ -0,0 +1,182 @@
+/*
+**  LICENSE: BSD
+**  Author: CandyMi[https://github.com/candymi]
+*/
+
+/*
+  编码/解码性能测试: 使用固定的测试数据集, 每个用例输出一行`JSON`, 便于在不同提交之间比较.
+    用法: ./msgpack_bench [每个用例的最短运行秒数(默认0.5)] [用例名称过滤]
+  字段说明:
+    bytes      : 编码结果的字节数
+    iters      : 计时循环的执行次数
+    ns_op      : 每次调用的耗时(纳秒)
+    mb_s       : 按编码结果字节数计算的吞吐量
+    allocs_op  : 每次调用的内存分配次数(包括`Lua`分配器与模块内部的`xrio_malloc/xrio_realloc`)
+    bytes_op   : 每次调用申请的内存字节数
+*/
+
+#include "msgpack.h"
+#include <time.h>
+
+LUAMOD_API int luaopen_lmsgpack(lua_State *L);
+
+/* `parallel_scan`的工作线程也会调用`msgpack_bench_realloc`, 所以计数器使用原子操作 */
+static struct {
+  uint64_t allocs;
+  uint64_t bytes;
+} counter;
+
+static inline void bench_count(size_t size) {
+  __atomic_fetch_add(&counter.allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&counter.bytes, size, __ATOMIC_RELAXED);
+}
+
+/* 模块内部的内存分配(定义了`USE_MSGPACK_BENCH`时由`xrio_malloc`等宏转发到这里) */
+void* msgpack_bench_realloc(void *ptr, size_t size) {
+  if (!size) {
+    free(ptr);
+    return NULL;
+  }
+  bench_count(size);
+  return realloc(ptr, size);
+}
+
+/* `Lua`分配器: 只统计新申请与扩大的内存 */
+static void* bench_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void)ud;
+  if (!nsize) {
+    free(ptr);
+    return NULL;
+  }
+  if (!ptr || nsize > osize) {
+    bench_count(ptr ? nsize - osize : nsize);
+  }
+  return realloc(ptr, nsize);
+}
+
+static inline double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+  测试数据集: 使用固定种子的线性同余生成器, 所以每次运行(以及不同的`Lua`版本)生成的数据完全一致.
+*/
+static const char *bench_fixtures =
+  "local seed = 20240101\n"
+  "local function rand(n) seed = (seed * 1103515245 + 12345) % 2147483648; return seed % n end\n"
+  "local function str(n) local t = {} for i = 1, n do t[i] = string.char(97 + rand(26)) end return table.concat(t) end\n"
+  "local F = {}\n"
+  "F[#F + 1] = { 'small_map', { id = 12345, name = 'msgpack', active = true, score = 98.5, tags = { 'a', 'b', 'c' } } }\n"
+  "local ints = {} for i = 1, 100000 do ints[i] = rand(1 << 30) - (1 << 29) end\n"
+  "F[#F + 1] = { 'int_array', { data = ints } }\n"
+  "local floats = {} for i = 1, 100000 do floats[i] = rand(1000000) / 7 end\n"
+  "F[#F + 1] = { 'float_array', { data = floats } }\n"
+  "local records = {}\n"
+  "for i = 1, 1000 do\n"
+  "  records[i] = { user = str(8), email = str(16), city = str(10), country = str(2),\n"
+  "                 title = str(24), body = str(120), lang = str(2), agent = str(40) }\n"
+  "end\n"
+  "F[#F + 1] = { 'string_records', { records = records } }\n"
+  "local deep = { value = 0 }\n"
+  "for i = 1, 15 do deep = { value = i, child = deep, list = { i, i + 1 } } end\n"
+  "F[#F + 1] = { 'deep_nesting', deep }\n"
+  "F[#F + 1] = { 'large_binary', { blob = str(1 << 20) } }\n"
+  "local mixed = {}\n"
+  "for i = 1, 100 do\n"
+  "  local t = { name = str(8), kind = str(4) }\n"
+  "  for j = i % 32 + 1, 1, -1 do t[j] = rand(1000) end\n"
+  "  mixed[i] = t\n"
+  "end\n"
+  "F[#F + 1] = { 'mixed_table', { items = mixed } }\n"
+  "local function same(a, b)\n"
+  "  if type(a) ~= 'table' or type(b) ~= 'table' then return a == b end\n"
+  "  for k, v in pairs(a) do if not same(v, b[k]) then return false end end\n"
+  "  for k in pairs(b) do if a[k] == nil then return false end end\n"
+  "  return true\n"
+  "end\n"
+  "return F, same\n";
+
+/* 计时: 反复执行栈顶的函数(参数为`arg`处的值), 直到运行时间超过`seconds`. */
+static void bench_run(lua_State *L, const char *name, const char *op, int func, int arg, size_t bytes, double seconds) {
+  /* 预热 */
+  lua_pushvalue(L, func); lua_pushvalue(L, arg);
+  lua_call(L, 1, 0);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+
+  uint64_t iters = 0; uint64_t allocs = __atomic_load_n(&counter.allocs, __ATOMIC_RELAXED); uint64_t abytes = __atomic_load_n(&counter.bytes, __ATOMIC_RELAXED);
+  double start = bench_now(); double elapsed = 0;
+  do {
+    for (int i = 0; i < 16; i++)
+    {
+      lua_pushvalue(L, func); lua_pushvalue(L, arg);
+      lua_call(L, 1, 0);
+    }
+    iters += 16;
+    elapsed = bench_now() - start;
+  } while (elapsed < seconds);
+  allocs = __atomic_load_n(&counter.allocs, __ATOMIC_RELAXED) - allocs; abytes = __atomic_load_n(&counter.bytes, __ATOMIC_RELAXED) - abytes;
+
+  printf("{\"fixture\":\"%s\",\"op\":\"%s\",\"bytes\":%zu,\"iters\":%llu,\"ns_op\":%.1f,\"mb_s\":%.2f,\"allocs_op\":%.2f,\"bytes_op\":%.1f}\n",
+    name, op, bytes, (unsigned long long)iters, elapsed * 1e9 / iters, bytes * iters / elapsed / (1024 * 1024),
+    (double)allocs / iters, (double)abytes / iters);
+  fflush(stdout);
+}
+
+/* 校验: 解码编码结果得到的值应当与原值完全相同(`same`由测试数据集提供) */
+static int bench_roundtrip(lua_State *L, int same, int decode, int value, int buffer) {
+  lua_pushvalue(L, same); lua_pushvalue(L, value);
+  lua_pushvalue(L, decode); lua_pushvalue(L, buffer);
+  lua_call(L, 1, 1);
+  lua_call(L, 2, 1);
+  int ok = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  return ok;
+}
+
+int main(int argc, char const *argv[]) {
+  double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+  const char *filter = argc > 2 ? argv[2] : NULL;
+
+  lua_State *L = lua_newstate(bench_alloc, NULL);
+  luaL_openlibs(L);
+  luaL_requiref(L, "lmsgpack", luaopen_lmsgpack, 0);
+  int lib = lua_gettop(L);
+  lua_getfield(L, lib, "encode");
+  int encode = lua_gettop(L);
+  lua_getfield(L, lib, "decode");
+  int decode = lua_gettop(L);
+
+  if (luaL_loadstring(L, bench_fixtures) != LUA_OK || lua_pcall(L, 0, 2, 0) != LUA_OK) {
+    fprintf(stderr, "fixtures: %s\n", lua_tostring(L, -1));
+    return 1;
+  }
+  int same = lua_gettop(L);
+  int fixtures = same - 1;
+
+  for (lua_Integer i = 1; lua_rawgeti(L, fixtures, i) == LUA_TTABLE; i++)
+  {
+    int fixture = lua_gettop(L);
+    lua_rawgeti(L, fixture, 1);
+    const char *name = lua_tostring(L, -1);
+    lua_rawgeti(L, fixture, 2);
+    int value = lua_gettop(L);
+    if (!filter || strstr(name, filter)) {
+      lua_pushvalue(L, encode); lua_pushvalue(L, value);
+      lua_call(L, 1, 1);
+      int buffer = lua_gettop(L);
+      size_t bytes = lua_rawlen(L, buffer);
+      if (!bench_roundtrip(L, same, decode, value, buffer)) {
+        fprintf(stderr, "%s: round trip mismatch\n", name);
+        return 1;
+      }
+      bench_run(L, name, "encode", encode, value, bytes, seconds);
+      bench_run(L, name, "decode", decode, buffer, bytes, seconds);
+    }
+    lua_settop(L, same);
+  }
+
+  lua_close(L);
+  return 0;
+}
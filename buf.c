@@ -7,10 +7,12 @@ static inline void xrio_resize(xrio_Buffer *B, size_t rsize) {
     B->b = B->ptr;
     return ;
   }
-  if (B->b == B->ptr)  /* Using heap for more string buffer. */
+  if (B->b == B->ptr) {  /* Using heap for more string buffer. */
     B->b = memcpy(xrio_realloc(NULL, rsize), B->ptr, B->bidx);
-  else                 /* Using `realloc` to got more memory. */
+    msgpack_stats_add(spills, 1);
+  } else                 /* Using `realloc` to got more memory. */
     B->b = xrio_realloc(B->b, rsize);
+  msgpack_stats_add(realloc_bytes, rsize);
   B->blen = rsize;
 }
 
@@ -20,6 +22,7 @@ void xrio_buffinit(lua_State *L, xrio_Buffer *B) {
 
 void* xrio_buffinitsize(lua_State *L, xrio_Buffer *B, size_t rsize) {
   B->b = NULL; B->bidx = 0; B->L = L; B->blen = 0;
+  B->write = NULL; B->ud = NULL;
   xrio_resize(B, rsize);
   return B->b;
 }
@@ -32,9 +35,20 @@ void xrio_pushresult(xrio_Buffer *B) {
   B->b = NULL; B->L = NULL;
 }
 
+/* 写出缓冲区中的所有内容(只用于设置了`write`的缓冲区) */
+void xrio_buffflush(xrio_Buffer *B) {
+  if (B->bidx > 0)
+    B->write(B, B->b, B->bidx);
+  B->bidx = 0;
+}
+
 void xrio_addchar(xrio_Buffer *B, char c) {
-  if (B->bidx + 1 >= B->blen)
-    xrio_resize(B, B->blen << 1);
+  if (B->bidx + 1 >= B->blen) {
+    if (B->write)
+      xrio_buffflush(B);
+    else
+      xrio_resize(B, B->blen << 1);
+  }
   B->b[B->bidx++] = c;
 }
 
@@ -43,6 +57,14 @@ void xrio_addlstring(xrio_Buffer *B, const char *b, size_t len) {
   {
     if (len == 1)
       return xrio_addchar(B, b[0]);
+    if (B->bidx + len >= B->blen && B->write)
+    {
+      xrio_buffflush(B);
+      if (len >= B->blen) {
+        B->write(B, b, len);
+        return;
+      }
+    }
     if (B->bidx + len >= B->blen)
     {
       size_t nsize = B->bidx + len;
@@ -56,8 +78,37 @@ void xrio_addlstring(xrio_Buffer *B, const char *b, size_t len) {
   }
 }
 
+/* 预留`len`字节并返回写入位置, 由调用者直接填充. */
+char* xrio_reserve(xrio_Buffer *B, size_t len) {
+  if (B->bidx + len >= B->blen && B->write)
+    xrio_buffflush(B);
+  if (B->bidx + len >= B->blen)
+  {
+    size_t nsize = B->bidx + len;
+    size_t blen = B->blen << 1;
+    while (nsize >= blen)
+      blen <<= 1;
+    xrio_resize(B, blen);
+  }
+  char *p = B->b + B->bidx;
+  B->bidx += len;
+  return p;
+}
+
 void xrio_addstring(xrio_Buffer *B, const char *b) {
   xrio_addlstring(B, b, strlen(b));
 }
 
-
+/* 在`idx`位置插入`len`字节的空间, 后续内容整体后移. */
+void xrio_insertspace(xrio_Buffer *B, size_t idx, size_t len) {
+  if (B->bidx + len >= B->blen)
+  {
+    size_t nsize = B->bidx + len;
+    size_t blen = B->blen << 1;
+    while (nsize >= blen)
+      blen <<= 1;
+    xrio_resize(B, blen);
+  }
+  memmove(B->b + idx + len, B->b + idx, B->bidx - idx);
+  B->bidx += len;
+}
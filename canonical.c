@@ -0,0 +1,232 @@
+#include "msgpack.h"
+
+/*
+  规范编码: `Map`的`key`按固定顺序排列(数值在前并按大小排列, 字符串在后并按字节序排列, 较短的前缀在前),
+  整数与浮点数本来就使用最短的编码格式, 所以相同内容的表总是得到完全相同的编码结果.
+*/
+typedef struct msgpack_CanonKey {
+  int type;           /* `0`: 整数, `1`: 浮点数, `2`: 字符串 */
+  lua_Integer i; lua_Number n;
+  const char *str; size_t len;
+  int idx;            /* 锚定的位置: 栈索引或临时表中的下标 */
+} msgpack_CanonKey;
+
+static int msgpack_canon_cmp(const void *a, const void *b) {
+  const msgpack_CanonKey *x = a, *y = b;
+  if ((x->type == 2) != (y->type == 2))
+    return x->type == 2 ? 1 : -1;
+  if (x->type == 2) {
+    int ret = memcmp(x->str, y->str, x->len < y->len ? x->len : y->len);
+    if (ret)
+      return ret;
+    return x->len < y->len ? -1 : x->len > y->len;
+  }
+  if (x->type == 0 && y->type == 0)
+    return x->i < y->i ? -1 : x->i > y->i;
+  lua_Number m = x->type == 0 ? (lua_Number)x->i : x->n, n = y->type == 0 ? (lua_Number)y->i : y->n;
+  if (m != n)
+    return m < n ? -1 : 1;
+  return x->type > y->type ? -1 : x->type < y->type;   /* 转换后相等时浮点数在前 */
+}
+
+#define MSGPACK_CANON_STACK (32)   /* 不超过此数量的`key`直接保存在栈上 */
+
+/*
+  编码栈顶的`Map`: 先收集并排序所有`key`, 数量已知所以头部不需要回填.
+  `key`被锚定在`Lua`栈上(较多时改为临时表), 所以编码`value`期间修改表也不会使字符串指针失效.
+*/
+int msgpack_enc_canonical_map(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int level) {
+  luaL_checkstack(L, 4, "[msgpack encode]: lua stack overflow.");
+  int tbl = lua_gettop(L);
+  size_t count = 0;
+  lua_pushnil(L);
+  while (lua_next(L, tbl))
+  {
+    lua_pop(L, 1);
+    int kt = lua_type(L, -1);
+    if (kt != LUA_TSTRING && kt != LUA_TNUMBER)
+      return msgpack_stats_error(MSGPACK_STATS_EENCODE), luaL_error(L, "[msgpack encode]: Invalid map key type `%s`.", lua_typename(L, kt));
+    count++;
+  }
+  msgpack_CanonKey stack[MSGPACK_CANON_STACK], *keys = stack;
+  int onstack = count <= MSGPACK_CANON_STACK, anchor = 0;
+  if (onstack)
+    luaL_checkstack(L, count + 3, "[msgpack encode]: lua stack overflow.");
+  else {
+    keys = lua_newuserdata(L, sizeof(msgpack_CanonKey) * count);
+    lua_createtable(L, count, 0);
+    anchor = lua_gettop(L);
+  }
+  size_t n = 0;
+  lua_pushnil(L);
+  while (lua_next(L, tbl))
+  {
+    lua_pop(L, 1);
+    msgpack_CanonKey *K = &keys[n++];
+    if (lua_type(L, -1) == LUA_TSTRING) {
+      K->type = 2; K->str = lua_tolstring(L, -1, &K->len);
+    } else if (lua_isinteger(L, -1)) {
+      K->type = 0; K->i = lua_tointeger(L, -1);
+    } else {
+      K->type = 1; K->n = lua_tonumber(L, -1);
+    }
+    lua_pushvalue(L, -1);
+    if (onstack) {
+      lua_insert(L, -2);    /* 保留在`lua_next`使用的`key`之下 */
+      K->idx = lua_gettop(L) - 1;
+    } else {
+      K->idx = (int)n;
+      lua_rawseti(L, anchor, K->idx);
+    }
+  }
+  qsort(keys, n, sizeof(msgpack_CanonKey), msgpack_canon_cmp);
+
+  msgpack_enc_length(L, B, n, 0x80, MSG_TYPE_MAP16, MSG_TYPE_MAP32);
+  for (size_t i = 0; i < n; i++)
+  {
+    if (keys[i].type == 2)
+      msgpack_enc_string(L, B, keys[i].str, keys[i].len);
+    else if (keys[i].type == 0)
+      msgpack_enc_integer(B, keys[i].i);
+    else
+      msgpack_enc_number(B, keys[i].n);
+    if (onstack)
+      lua_pushvalue(L, keys[i].idx);
+    else
+      lua_rawgeti(L, anchor, keys[i].idx);
+    lua_rawget(L, tbl);
+    msgpack_enc_value(L, E, B, level, "map");
+    lua_pop(L, 1);
+  }
+  lua_settop(L, tbl);
+  return 0;
+}
+
+/* xxHash64(种子为`0`): 按任意大小的分段输入, 结果与一次性计算相同. */
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define xxh_rotl64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+typedef struct msgpack_XXH64 {
+  uint64_t v[4];
+  uint64_t total;
+  unsigned char mem[32]; size_t memsize;
+} msgpack_XXH64;
+
+static inline uint64_t xxh_read64(const unsigned char *p) {
+  uint64_t v; memcpy(&v, p, 8);
+#if BYTE_ORDER == LITTLE_ENDIAN
+  return v;
+#else
+  return xrio_swap64(v);
+#endif
+}
+
+static inline uint32_t xxh_read32(const unsigned char *p) {
+  uint32_t v; memcpy(&v, p, 4);
+#if BYTE_ORDER == LITTLE_ENDIAN
+  return v;
+#else
+  return xrio_swap32(v);
+#endif
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH_PRIME64_2;
+  acc = xxh_rotl64(acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+  acc ^= xxh_round(0, val);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static void msgpack_xxh64_init(msgpack_XXH64 *H) {
+  H->v[0] = XXH_PRIME64_1 + XXH_PRIME64_2; H->v[1] = XXH_PRIME64_2;
+  H->v[2] = 0; H->v[3] = -XXH_PRIME64_1;
+  H->total = 0; H->memsize = 0;
+}
+
+static void msgpack_xxh64_update(msgpack_XXH64 *H, const char *data, size_t len) {
+  const unsigned char *p = (const unsigned char*)data, *end = p + len;
+  H->total += len;
+  if (H->memsize + len < 32) {
+    memcpy(H->mem + H->memsize, p, len);
+    H->memsize += len;
+    return;
+  }
+  if (H->memsize) {
+    memcpy(H->mem + H->memsize, p, 32 - H->memsize);
+    p += 32 - H->memsize;
+    for (int i = 0; i < 4; i++)
+      H->v[i] = xxh_round(H->v[i], xxh_read64(H->mem + i * 8));
+    H->memsize = 0;
+  }
+  for (; p + 32 <= end; p += 32)
+  {
+    H->v[0] = xxh_round(H->v[0], xxh_read64(p));
+    H->v[1] = xxh_round(H->v[1], xxh_read64(p + 8));
+    H->v[2] = xxh_round(H->v[2], xxh_read64(p + 16));
+    H->v[3] = xxh_round(H->v[3], xxh_read64(p + 24));
+  }
+  if (p < end) {
+    memcpy(H->mem, p, end - p);
+    H->memsize = end - p;
+  }
+}
+
+static uint64_t msgpack_xxh64_digest(msgpack_XXH64 *H) {
+  uint64_t h;
+  if (H->total >= 32) {
+    h = xxh_rotl64(H->v[0], 1) + xxh_rotl64(H->v[1], 7) + xxh_rotl64(H->v[2], 12) + xxh_rotl64(H->v[3], 18);
+    for (int i = 0; i < 4; i++)
+      h = xxh_merge(h, H->v[i]);
+  } else
+    h = XXH_PRIME64_5;
+  h += H->total;
+  const unsigned char *p = H->mem, *end = p + H->memsize;
+  for (; p + 8 <= end; p += 8)
+  {
+    h ^= xxh_round(0, xxh_read64(p));
+    h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+    h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    p += 4;
+  }
+  for (; p < end; p++)
+  {
+    h ^= (*p) * XXH_PRIME64_5;
+    h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+  }
+  h ^= h >> 33; h *= XXH_PRIME64_2;
+  h ^= h >> 29; h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+/*
+  编码`idx`处的值并计算结果的`xxHash64`, 压入编码结果与哈希值(`64`位整数).
+  与普通编码使用相同的缓冲区(保留`key`缓存与单次遍历的`Array`), 完成后对连续的结果计算一次哈希, 不需要额外的复制.
+*/
+int msgpack_encode_hash(lua_State *L, int idx, int canonical) {
+  xrio_Buffer B;
+  xrio_buffinit(L, &B);
+  if (msgpack_encode_pcall(L, idx, &B, canonical) != LUA_OK) {
+    B.L = NULL; xrio_pushresult(&B);
+    return lua_error(L);
+  }
+  msgpack_XXH64 H;
+  msgpack_xxh64_init(&H);
+  msgpack_xxh64_update(&H, B.b, xrio_buffgetidx((&B)));
+  msgpack_stats_message(1, xrio_buffgetidx((&B)));
+  xrio_pushresult(&B);
+  lua_pushinteger(L, (lua_Integer)msgpack_xxh64_digest(&H));
+  return 2;
+}
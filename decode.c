@@ -1,419 +1,720 @@
 #include "msgpack.h"
 
-int msgpack_dec_map(lua_State *L, int level, const char *buffer, size_t bsize);
-int msgpack_dec_array(lua_State *L, int level, const char *buffer, size_t bsize);
+#if defined(USE_MSGPACK_KEY32)
+  #define MSGPACK_KEY32 (1)
+#else
+  #define MSGPACK_KEY32 (0)
+#endif
 
-/* 解码`Nil` */
-int msgpack_dec_nil(lua_State *L) {
-  lua_pushlightuserdata(L, NULL);
-  return 1;
-}
+#define MSGPACK_LEAD(op, kind, hlen, lbytes, inl, key)  { MSGPACK_OP_##op, MSGPACK_KIND_##kind, hlen, lbytes, inl, key }
 
-/* 解码`Boolean` */
-int msgpack_dec_boolean(lua_State *L, bool ok) {
-  lua_pushboolean(L, ok);
-  return 1;
+/* `fixstr`/`fixarray`/`fixmap`: 长度或元素数量随首字节递增 */
+#define MSGPACK_FIX2(op, kind, n, key)   MSGPACK_LEAD(op, kind, 1, 0, (n), key), MSGPACK_LEAD(op, kind, 1, 0, (n) + 1, key)
+#define MSGPACK_FIX4(op, kind, n, key)   MSGPACK_FIX2(op, kind, n, key), MSGPACK_FIX2(op, kind, (n) + 2, key)
+#define MSGPACK_FIX8(op, kind, n, key)   MSGPACK_FIX4(op, kind, n, key), MSGPACK_FIX4(op, kind, (n) + 4, key)
+#define MSGPACK_FIX16(op, kind, n, key)  MSGPACK_FIX8(op, kind, n, key), MSGPACK_FIX8(op, kind, (n) + 8, key)
+#define MSGPACK_FIX32(op, kind, n, key)  MSGPACK_FIX16(op, kind, n, key), MSGPACK_FIX16(op, kind, (n) + 16, key)
+
+const msgpack_Lead msgpack_leads[256] = {
+  [0x00 ... 0x7f] = MSGPACK_LEAD(POSFIX, SCALAR, 1, 0, 0, 1),
+  [0x80]          = MSGPACK_FIX16(FIXMAP, MAP, 0, 0),
+  [0x90]          = MSGPACK_FIX16(FIXARRAY, ARRAY, 0, 0),
+  [0xa0]          = MSGPACK_FIX32(FIXSTR, SCALAR, 0, 1),
+  [0xc0]          = MSGPACK_LEAD(NIL, SCALAR, 1, 0, 0, 0),
+  [0xc1]          = MSGPACK_LEAD(INVALID, SCALAR, 1, 0, 0, 0),
+  [0xc2]          = MSGPACK_LEAD(FALSE, SCALAR, 1, 0, 0, 0),
+  [0xc3]          = MSGPACK_LEAD(TRUE, SCALAR, 1, 0, 0, 0),
+  [0xc4]          = MSGPACK_LEAD(STR8, SCALAR, 1, 1, 0, 1),             /* bin8 */
+  [0xc5]          = MSGPACK_LEAD(STR16, SCALAR, 1, 2, 0, 1),            /* bin16 */
+  [0xc6]          = MSGPACK_LEAD(STR32, SCALAR, 1, 4, 0, MSGPACK_KEY32), /* bin32 */
+  [0xc7]          = MSGPACK_LEAD(EXT, SCALAR, 2, 1, 0, 0),
+  [0xc8]          = MSGPACK_LEAD(EXT, SCALAR, 2, 2, 0, 0),
+  [0xc9]          = MSGPACK_LEAD(EXT, SCALAR, 2, 4, 0, 0),
+  [0xca]          = MSGPACK_LEAD(FLOAT32, SCALAR, 1, 0, 4, 1),
+  [0xcb]          = MSGPACK_LEAD(FLOAT64, SCALAR, 1, 0, 8, 1),
+  [0xcc]          = MSGPACK_LEAD(UINT8, SCALAR, 1, 0, 1, 1),
+  [0xcd]          = MSGPACK_LEAD(UINT16, SCALAR, 1, 0, 2, 1),
+  [0xce]          = MSGPACK_LEAD(UINT32, SCALAR, 1, 0, 4, 1),
+  [0xcf]          = MSGPACK_LEAD(UINT64, SCALAR, 1, 0, 8, 1),
+  [0xd0]          = MSGPACK_LEAD(INT8, SCALAR, 1, 0, 1, 1),
+  [0xd1]          = MSGPACK_LEAD(INT16, SCALAR, 1, 0, 2, 1),
+  [0xd2]          = MSGPACK_LEAD(INT32, SCALAR, 1, 0, 4, 1),
+  [0xd3]          = MSGPACK_LEAD(INT64, SCALAR, 1, 0, 8, 1),
+  [0xd4]          = MSGPACK_LEAD(EXT, SCALAR, 2, 0, 1, 0),              /* fixext1 */
+  [0xd5]          = MSGPACK_LEAD(EXT, SCALAR, 2, 0, 2, 0),
+  [0xd6]          = MSGPACK_LEAD(EXT, SCALAR, 2, 0, 4, 0),
+  [0xd7]          = MSGPACK_LEAD(EXT, SCALAR, 2, 0, 8, 0),
+  [0xd8]          = MSGPACK_LEAD(EXT, SCALAR, 2, 0, 16, 0),
+  [0xd9]          = MSGPACK_LEAD(STR8, SCALAR, 1, 1, 0, 1),
+  [0xda]          = MSGPACK_LEAD(STR16, SCALAR, 1, 2, 0, 1),
+  [0xdb]          = MSGPACK_LEAD(STR32, SCALAR, 1, 4, 0, MSGPACK_KEY32),
+  [0xdc]          = MSGPACK_LEAD(ARRAY16, ARRAY, 1, 2, 0, 0),
+  [0xdd]          = MSGPACK_LEAD(ARRAY32, ARRAY, 1, 4, 0, 0),
+  [0xde]          = MSGPACK_LEAD(MAP16, MAP, 1, 2, 0, 0),
+  [0xdf]          = MSGPACK_LEAD(MAP32, MAP, 1, 4, 0, 0),
+  [0xe0 ... 0xff] = MSGPACK_LEAD(NEGFIX, SCALAR, 1, 0, 0, 1),
+};
+
+/* 根据长度与首、中、尾字节计算`key`缓存的槽位 */
+static inline uint32_t msgpack_keycache_slot(const char *key, size_t len) {
+  const uint8_t *k = (const uint8_t*)key;
+  return (len * 31 + k[0] * 7 + k[len >> 1] * 3 + k[len - 1]) & (MSGPACK_KEYCACHE_SIZE - 1);
 }
 
-int msgpack_dec_number(lua_State *L, size_t bit, const char* buffer, size_t bsize) {
-  if (bsize < bit)
-    return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_float`.(%d, %d)", bit, bsize);
-  if (bit == 8)
-  {
-    xrio_u64_t v = {.i = *(uint64_t*)buffer};
-    xrio_ntoh64((uint64_t*)v.ptr);
-    if (isnan(v.n) || isinf(v.n))
-      return luaL_error(L, "[msgpack decode]: `msgpack_dec_float64` has got `INF` or `NaN` key.");
-    lua_pushnumber(L, v.n);
-    return 8;
+/*
+  解码`Map`的字符串`key`: 启用缓存时, 重复出现的短`key`只需一次`memcmp`即可直接复用已创建的`Lua`字符串.
+  缓存的字符串保存在`anchor`表内, 所以槽位中的指针在解码期间始终有效.
+*/
+static inline void msgpack_dec_key(lua_State *L, msgpack_KeyCache *K, const char *key, size_t len) {
+  if (len == 0 || len > MSGPACK_KEYCACHE_KEYLEN) {
+    lua_pushlstring(L, key, len);
+    return;
   }
-  else
-  {
-    xrio_u32_t v = {.i = *(uint32_t*)buffer};
-    xrio_ntoh32((uint32_t*)v.ptr);
-    if (isnan(v.n) || isinf(v.n))
-      return luaL_error(L, "[msgpack decode]: `msgpack_dec_float32` has got `INF` or `NaN` key.");
-    lua_pushnumber(L, v.n);
-    return 4;
+  uint32_t slot = msgpack_keycache_slot(key, len);
+  if (K->slots[slot].len == len && !memcmp(K->slots[slot].key, key, len)) {
+    lua_rawgeti(L, K->anchor, slot + 1);
+    return;
   }
+  K->slots[slot].key = lua_pushlstring(L, key, len);
+  K->slots[slot].len = len;
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, K->anchor, slot + 1);
 }
 
-/* 解码`fixint` */
-int msgpack_dec_fixint(lua_State *L, uint8_t v) {
-  if (v >= 0xe0)
-  {
-    lua_pushinteger(L, v - 0x100);
-    return 1;
-  }
-  else if(v <= 0x7f)
-  {
-    lua_pushinteger(L, v);
-    return 1;
-  }
-  return 0;
+/* 解码栈中的一层容器 */
+typedef struct msgpack_DecFrame {
+  uint32_t count;   /* 剩余元素数量(`Map`为键值对数量) */
+  uint32_t idx;     /* `Array`: 下一个下标; `Map`: 为`1`时`key`已压入栈顶, 等待`value`. */
+  uint8_t kind;
+} msgpack_DecFrame;
+
+#define MSGPACK_DECFRAME_SIZE (32)
+
+/* `max_memory`使用的估计值: 表头部、数组部分的元素、哈希部分的节点与字符串头部 */
+#define MSGPACK_MEM_TABLE   (64)
+#define MSGPACK_MEM_SLOT    (16)
+#define MSGPACK_MEM_NODE    (32)
+#define MSGPACK_MEM_STRING  (32)
+
+/* 即将创建长度为`len`的字符串: 超出`max_string`或`max_memory`时抛出异常. */
+void msgpack_dec_strlimit(lua_State *L, msgpack_Decoder *D, size_t len) {
+  if (D->max_string && len > D->max_string)
+    msgpack_stats_error(MSGPACK_STATS_ELIMIT), luaL_error(L, "[msgpack error]: The maximum user-defined string length was exceeded.");
+  D->memory += MSGPACK_MEM_STRING + len;
+  if (D->max_memory && D->memory > D->max_memory)
+    msgpack_stats_error(MSGPACK_STATS_ELIMIT), luaL_error(L, "[msgpack error]: The maximum user-defined memory usage was exceeded.");
 }
 
-/* 解码`int` */
-int msgpack_dec_int(lua_State *L, size_t bit, const char *buffer, size_t bsize) {
-  if (bit == 1) {
-    if (bsize == 0)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_int8`.(%d)", bsize);
-    lua_pushinteger(L, *(int8_t*)buffer);
-    return 1;
-  }
-  if (bit == 2) {
-    if (bsize < bit)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_int16`.(%d)", bsize);
-    uint16_t len = *(uint16_t*)buffer; xrio_ntoh16(&len);
-    lua_pushinteger(L, (int16_t)len);
-    return 2;
-  }
-  if (bit == 4) {
-    if (bsize < bit)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_int32`.(%d)", bsize);
-    uint32_t len = *(uint32_t*)buffer; xrio_ntoh32(&len);
-    lua_pushinteger(L, (int32_t)len);
-    return 4;
-  }
-  if (bsize < 8)
-    return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_int64`.(%d)", bsize);
-  uint64_t len = *(uint64_t*)buffer; xrio_ntoh64(&len);
-  lua_pushinteger(L, len);
-  return 8;
-}
-
-/* 解码`uint` */
-int msgpack_dec_uint(lua_State *L, size_t bit, const char *buffer, size_t bsize) {
-  if (bit == 1) {
-    if (bsize == 0)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_uint8`.(%d)", bsize);
-    lua_pushinteger(L, *(uint8_t*)buffer);
-    return 1;
-  }
-  if (bit == 2) {
-    uint16_t len = *(uint16_t*)buffer; xrio_ntoh16(&len);
-    if (bsize < bit)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_uint16`.(%d)", bsize);
-    lua_pushinteger(L, (uint16_t)len);
-    return 2;
-  }
-  if (bit == 4) {
-    if (bsize < bit)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_uint32`.(%d)", bsize);
-    uint32_t len = *(uint32_t*)buffer; xrio_ntoh32(&len);
-    lua_pushinteger(L, (uint32_t)len);
-    return 4;
-  }
-  if (bsize < 8)
-    return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_uint64`.(%d)", bsize);
-  uint64_t len = *(uint64_t*)buffer; xrio_ntoh64(&len);
-  lua_pushinteger(L, len);
-  return 8;
-}
-
-/* 解码`Bin`/`Str` */
-int msgpack_dec_string(lua_State *L, size_t bit, const char *buffer, size_t bsize) {
-  if (bit == 1) {
-    uint8_t len = *(uint8_t*)buffer;
-    if (bsize < len)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_string`.");
-    lua_pushlstring(L, buffer + bit, len);
-    return len + bit;
-  }
-  if (bit == 2) {
-    uint16_t len = *(uint16_t*)buffer; xrio_ntoh16(&len);
-    if (bsize < len)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_string`.");
-    lua_pushlstring(L, buffer + bit, len);
-    return len + bit;
-  }
-  /* fixstr */
-  if (bit >= 0xa0 && bit <= 0xbf) {
-    uint8_t len = bit - 0xa0;
-    if (bsize < len)
-      return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_string`.");
-    lua_pushlstring(L, buffer, len);
-    return len;
-  }
-  /* Bin 32 or Str 32 */
-  uint32_t len = *(uint32_t*)buffer; xrio_ntoh32(&len);
-  if (bsize < len)
-    return luaL_error(L, "[msgpack decode]: string buffers not enough in `msgpack_dec_string`.");
-#if !defined(USE_MSGPACK_STR24)
-  if (len >= 16777216)
-    return luaL_error(L, "[msgpack decode]: The string exceeds the parse length.");
-#endif
-  lua_pushlstring(L, buffer + bit, len);
-  return len + bit;
+/* 即将创建包含`count`个元素的容器: 超出`max_elements`或`max_memory`时抛出异常. */
+static inline void msgpack_dec_tablelimit(lua_State *L, msgpack_Decoder *D, uint8_t kind, uint32_t count) {
+  D->elements += count;
+  if (D->max_elements && D->elements > D->max_elements)
+    msgpack_stats_error(MSGPACK_STATS_ELIMIT), luaL_error(L, "[msgpack error]: The maximum user-defined number of elements was exceeded.");
+  D->memory += MSGPACK_MEM_TABLE + (size_t)count * (kind == MSGPACK_KIND_MAP ? MSGPACK_MEM_NODE : MSGPACK_MEM_SLOT);
+  if (D->max_memory && D->memory > D->max_memory)
+    msgpack_stats_error(MSGPACK_STATS_ELIMIT), luaL_error(L, "[msgpack error]: The maximum user-defined memory usage was exceeded.");
 }
 
-int msgpack_dec_array(lua_State *L, int level, const char *buffer, size_t bsize) {
-  uint32_t len = 0; size_t expend = bsize;
-  uint8_t type = *buffer;
+/* 支持`computed goto`时每个处理分支各自跳转, 否则退化为`switch`. */
+#if defined(__GNUC__)
+  #define msgpack_dispatch(op)  goto *msgpack_ops[op];
+  #define msgpack_case(op)      L_##op:
+#else
+  #define msgpack_dispatch(op)  switch (op)
+  #define msgpack_case(op)      case op:
+#endif
 
-  if (type == MSG_TYPE_ARR16 || type == MSG_TYPE_ARR32)
-  {
-    if (type == MSG_TYPE_ARR16)
-    {
-      if (bsize < 3)
-        return luaL_error(L, "[msgpack decode]: Insufficient remaining byte array for array16.");
-      uint16_t l = *(uint16_t*)(buffer + 1); xrio_ntoh16(&l); len = l;
-      buffer += 3; bsize -= 3;
-    }
-    else // type == MSG_TYPE_ARR32
-    {
-      if (bsize < 5)
-        return luaL_error(L, "[msgpack decode]: Insufficient remaining byte array for array32.");
-      uint32_t l = *(uint32_t*)(buffer + 1); xrio_ntoh32(&l); len = l;
-      buffer += 5; bsize -= 5;
-    }
-  }
-  else if (type >= 0x90 && type <= 0x9f) // fix array
-  {
-    buffer++; bsize--; len = type - 0x90;
-  }
-  else
-    return luaL_error(L, "[msgpack decode]: unknown byte type.");
+#define msgpack_dec_need(n, what) \
+  if (bsize < (n)) \
+    return msgpack_stats_error(MSGPACK_STATS_ETRUNCATED), luaL_error(L, "[msgpack decode]: Insufficient remaining byte array for %s.", what);
 
-  if (level >= USE_MSGPACK_MAX_STACK)
-    return luaL_error(L, "[msgpack error]: The maximum user-defined parsing depth was exceeded.");
+/*
+  迭代解码: 用显式的容器栈代替`dec_map`与`dec_array`之间的相互递归, `key`与`value`共用同一个分发点,
+  每个值只需查一次首字节描述表(`msgpack_leads`)即可跳转到对应的处理分支.
+  正在构建的容器依次保存在`Lua`栈上(`Map`的`key`紧随其后), 所以元素完成后总是赋值给`-2`或`-3`处的表.
+  栈帧超出`MSGPACK_DECFRAME_SIZE`时改为保存在`base + 1`处的`userdata`中, 出错时由`GC`回收.
+  `level`为第一个容器所在的层级, 超过`max_depth`时结束解析.
+*/
+static size_t msgpack_dec_iter(lua_State *L, msgpack_Decoder *D, int level, const char *buffer, size_t bsize) {
+#if defined(__GNUC__)
+  static const void *const msgpack_ops[] = {
+    &&L_MSGPACK_OP_POSFIX, &&L_MSGPACK_OP_NEGFIX, &&L_MSGPACK_OP_NIL, &&L_MSGPACK_OP_FALSE, &&L_MSGPACK_OP_TRUE,
+    &&L_MSGPACK_OP_FIXSTR, &&L_MSGPACK_OP_STR8, &&L_MSGPACK_OP_STR16, &&L_MSGPACK_OP_STR32,
+    &&L_MSGPACK_OP_FLOAT32, &&L_MSGPACK_OP_FLOAT64,
+    &&L_MSGPACK_OP_UINT8, &&L_MSGPACK_OP_UINT16, &&L_MSGPACK_OP_UINT32, &&L_MSGPACK_OP_UINT64,
+    &&L_MSGPACK_OP_INT8, &&L_MSGPACK_OP_INT16, &&L_MSGPACK_OP_INT32, &&L_MSGPACK_OP_INT64,
+    &&L_MSGPACK_OP_FIXARRAY, &&L_MSGPACK_OP_ARRAY16, &&L_MSGPACK_OP_ARRAY32,
+    &&L_MSGPACK_OP_FIXMAP, &&L_MSGPACK_OP_MAP16, &&L_MSGPACK_OP_MAP32,
+    &&L_MSGPACK_OP_EXT, &&L_MSGPACK_OP_INVALID,
+  };
+#endif
+  msgpack_DecFrame stack[MSGPACK_DECFRAME_SIZE];
+  msgpack_DecFrame *frames = stack; int cap = MSGPACK_DECFRAME_SIZE;
+  int base = lua_gettop(L); int depth = 0;
+  int max_depth = D->max_depth > 0 ? D->max_depth : USE_MSGPACK_MAX_STACK - 1;
+  const char *start = buffer;
 
-  size_t offset; size_t idx = 1;
-  // xrio_log("array 长度为: %u\n", len);
-  lua_createtable(L, len, 0);
-  while (len--)
+  for (;;)
   {
-    uint8_t vt = *buffer;
-    switch (vt)
+    int iskey = depth && frames[depth - 1].kind == MSGPACK_KIND_MAP && !frames[depth - 1].idx;
+    msgpack_dec_need(1, "value");
+    uint8_t t = *(const uint8_t*)buffer;
+    const msgpack_Lead *d = &msgpack_leads[t];
+    size_t len; uint32_t count; uint8_t kind;
+    if (iskey && !d->key) {
+      msgpack_stats_error(MSGPACK_STATS_EFORMAT);
+      if (t == MSG_TYPE_BIN32 || t == MSG_TYPE_STR32)
+        return luaL_error(L, "[msgpack decode]: The 32-bit map key is not supported.");
+      return luaL_error(L, "[msgpack decode]: The map key type is not supported.(%d)", t);
+    }
+
+    msgpack_dispatch(d->op)
     {
-      case MSG_TYPE_NIL:
-        offset = msgpack_dec_nil(L);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_TRUE: case MSG_TYPE_FALSE:
-        offset = msgpack_dec_boolean(L, vt == MSG_TYPE_TRUE);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_BIN8: case MSG_TYPE_BIN16: case MSG_TYPE_BIN32:
-        offset = msgpack_dec_string(L, 1 << (vt - MSG_TYPE_BIN8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_STR8: case MSG_TYPE_STR16: case MSG_TYPE_STR32:
-        offset = msgpack_dec_string(L, 1 << (vt - MSG_TYPE_STR8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_FLOAT32: case MSG_TYPE_FLOAT64:
-        offset = msgpack_dec_number(L, 4 << (vt - MSG_TYPE_FLOAT32), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_UINT8: case MSG_TYPE_UINT16: case MSG_TYPE_UINT32: case MSG_TYPE_UINT64:
-        offset = msgpack_dec_uint(L, 1 << (vt - MSG_TYPE_UINT8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_INT8: case MSG_TYPE_INT16: case MSG_TYPE_INT32: case MSG_TYPE_INT64:
-        offset = msgpack_dec_int(L, 1 << (vt - MSG_TYPE_INT8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_ARR16: case MSG_TYPE_ARR32:            /* 定长数组 */
-        offset = msgpack_dec_array(L, level + 1, buffer, bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_MAP16: case MSG_TYPE_MAP32:            /* 定长字典 */
-        offset = msgpack_dec_map(L, level + 1, buffer, bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      default:
-        if (vt <= 0x7f || vt >= 0xe0) {     /* fix uint8 */
-          offset = msgpack_dec_fixint(L, vt);
-          buffer += offset; bsize -= offset;
-          break;
-        }
-        else if (vt >= 0xa0 && vt <= 0xbf) /* fix str */
-        {
-          offset = msgpack_dec_string(L, vt, ++buffer, --bsize);
-          buffer += offset; bsize -= offset;
-          break;
-        }
-        else if (vt >= 0x90 && vt <= 0x9f) /* fix array */
+      msgpack_case(MSGPACK_OP_POSFIX)
+        lua_pushinteger(L, t);
+        len = 1; goto value;
+      msgpack_case(MSGPACK_OP_NEGFIX)
+        lua_pushinteger(L, (int8_t)t);
+        len = 1; goto value;
+      msgpack_case(MSGPACK_OP_NIL)
+        lua_pushlightuserdata(L, NULL);
+        len = 1; goto value;
+      msgpack_case(MSGPACK_OP_FALSE)
+        lua_pushboolean(L, 0);
+        len = 1; goto value;
+      msgpack_case(MSGPACK_OP_TRUE)
+        lua_pushboolean(L, 1);
+        len = 1; goto value;
+      msgpack_case(MSGPACK_OP_FIXSTR)
+        len = d->inl;
+        msgpack_dec_need(1 + len, "fixstr");
+        buffer += 1; bsize -= 1;
+        goto string;
+      msgpack_case(MSGPACK_OP_STR8)
+        msgpack_dec_need(2, "str8");
+        len = *(const uint8_t*)(buffer + 1);
+        msgpack_dec_need(2 + len, "str8");
+        buffer += 2; bsize -= 2;
+        goto string;
+      msgpack_case(MSGPACK_OP_STR16)
+        msgpack_dec_need(3, "str16");
+        len = xrio_load16(buffer + 1);
+        msgpack_dec_need(3 + len, "str16");
+        buffer += 3; bsize -= 3;
+        goto string;
+      msgpack_case(MSGPACK_OP_STR32)
+        msgpack_dec_need(5, "str32");
+        len = xrio_load32(buffer + 1);
+        msgpack_dec_need(5 + len, "str32");
+#if !defined(USE_MSGPACK_STR24)
+        if (len >= 16777216)
+          return msgpack_stats_error(MSGPACK_STATS_EFORMAT), luaL_error(L, "[msgpack decode]: The string exceeds the parse length.");
+#endif
+        buffer += 5; bsize -= 5;
+        goto string;
+      msgpack_case(MSGPACK_OP_FLOAT32)
         {
-          offset = msgpack_dec_array(L, level + 1, buffer, bsize);
-          buffer += offset; bsize -= offset;
-          break;
+          msgpack_dec_need(5, "float32");
+          xrio_u32_t v = { .i = xrio_load32(buffer + 1) };
+          if (isnan(v.n) || isinf(v.n))
+            return msgpack_stats_error(MSGPACK_STATS_EFORMAT), luaL_error(L, "[msgpack decode]: `msgpack_dec_float32` has got `INF` or `NaN` key.");
+          lua_pushnumber(L, v.n);
+          len = 5; goto value;
         }
-        else if (vt >= 0x80 && vt <= 0x8f) /* fix map */
+      msgpack_case(MSGPACK_OP_FLOAT64)
         {
-          offset = msgpack_dec_map(L, level + 1, buffer, bsize);
-          buffer += offset; bsize -= offset;
-          break;
+          msgpack_dec_need(9, "float64");
+          xrio_u64_t v = { .i = xrio_load64(buffer + 1) };
+          if (isnan(v.n) || isinf(v.n))
+            return msgpack_stats_error(MSGPACK_STATS_EFORMAT), luaL_error(L, "[msgpack decode]: `msgpack_dec_float64` has got `INF` or `NaN` key.");
+          lua_pushnumber(L, v.n);
+          len = 9; goto value;
         }
-        return luaL_error(L, "[msgpack decode]: The array value type is not supported.(%d)", vt);
+      msgpack_case(MSGPACK_OP_UINT8)
+        msgpack_dec_need(2, "uint8");
+        lua_pushinteger(L, *(const uint8_t*)(buffer + 1));
+        len = 2; goto value;
+      msgpack_case(MSGPACK_OP_UINT16)
+        msgpack_dec_need(3, "uint16");
+        lua_pushinteger(L, xrio_load16(buffer + 1));
+        len = 3; goto value;
+      msgpack_case(MSGPACK_OP_UINT32)
+        msgpack_dec_need(5, "uint32");
+        lua_pushinteger(L, xrio_load32(buffer + 1));
+        len = 5; goto value;
+      msgpack_case(MSGPACK_OP_UINT64)
+        msgpack_dec_need(9, "uint64");
+        lua_pushinteger(L, (lua_Integer)xrio_load64(buffer + 1));
+        len = 9; goto value;
+      msgpack_case(MSGPACK_OP_INT8)
+        msgpack_dec_need(2, "int8");
+        lua_pushinteger(L, *(const int8_t*)(buffer + 1));
+        len = 2; goto value;
+      msgpack_case(MSGPACK_OP_INT16)
+        msgpack_dec_need(3, "int16");
+        lua_pushinteger(L, (int16_t)xrio_load16(buffer + 1));
+        len = 3; goto value;
+      msgpack_case(MSGPACK_OP_INT32)
+        msgpack_dec_need(5, "int32");
+        lua_pushinteger(L, (int32_t)xrio_load32(buffer + 1));
+        len = 5; goto value;
+      msgpack_case(MSGPACK_OP_INT64)
+        msgpack_dec_need(9, "int64");
+        lua_pushinteger(L, (int64_t)xrio_load64(buffer + 1));
+        len = 9; goto value;
+      msgpack_case(MSGPACK_OP_FIXARRAY)
+        kind = MSGPACK_KIND_ARRAY; count = d->inl;
+        len = 1; goto container;
+      msgpack_case(MSGPACK_OP_ARRAY16)
+        msgpack_dec_need(3, "array16");
+        kind = MSGPACK_KIND_ARRAY; count = xrio_load16(buffer + 1);
+        len = 3; goto container;
+      msgpack_case(MSGPACK_OP_ARRAY32)
+        msgpack_dec_need(5, "array32");
+        kind = MSGPACK_KIND_ARRAY; count = xrio_load32(buffer + 1);
+        len = 5; goto container;
+      msgpack_case(MSGPACK_OP_FIXMAP)
+        kind = MSGPACK_KIND_MAP; count = d->inl;
+        len = 1; goto container;
+      msgpack_case(MSGPACK_OP_MAP16)
+        msgpack_dec_need(3, "map16");
+        kind = MSGPACK_KIND_MAP; count = xrio_load16(buffer + 1);
+        len = 3; goto container;
+      msgpack_case(MSGPACK_OP_MAP32)
+        msgpack_dec_need(5, "map32");
+        kind = MSGPACK_KIND_MAP; count = xrio_load32(buffer + 1);
+        len = 5; goto container;
+      msgpack_case(MSGPACK_OP_EXT)
+        len = msgpack_dec_ext(L, D, buffer, bsize);
+        goto value;
+      msgpack_case(MSGPACK_OP_INVALID)
+        return msgpack_stats_error(MSGPACK_STATS_EFORMAT), luaL_error(L, "[msgpack decode]: The value type is not supported.(%d)", t);
     }
-    lua_rawseti(L, -2, idx++);
-  }
-  luaL_setmetatable(L, "lua_List");
-  // xrio_log("end size = %zu\n", bsize);
-  return expend - bsize;
-}
-
-int msgpack_dec_map(lua_State *L, int level, const char *buffer, size_t bsize) {
-  uint8_t type = *buffer;
-  
-  /* 如果是数组类型 */
-  if (type == MSG_TYPE_ARR16 || type == MSG_TYPE_ARR32)
-    return msgpack_dec_array(L, level, buffer, bsize);
-  else if (type >= 0x90 && type <= 0x9f)
-    return msgpack_dec_array(L, level, buffer, bsize);
-
-  uint32_t len = 0; size_t expend = bsize;
-  if (type == MSG_TYPE_MAP16 || type == MSG_TYPE_MAP32) {
-    if (type == MSG_TYPE_MAP16)
-    {
-      if (bsize < 3)
-        return luaL_error(L, "[msgpack decode]: Insufficient remaining byte array for map16.");
-      uint16_t l = *(uint16_t*)(buffer + 1); xrio_ntoh16(&l); len = l;
-      buffer += 3; bsize -= 3;
+
+  string:
+    /* `buffer`已指向字符串内容 */
+    if (D->max_string || D->max_memory)
+      msgpack_dec_strlimit(L, D, len);
+    if (iskey && D->keys)
+      msgpack_dec_key(L, D->keys, buffer, len);
+    else
+      lua_pushlstring(L, buffer, len);
+    goto value;
+
+  container:
+    buffer += len; bsize -= len;
+    if (level + depth > max_depth)
+      return msgpack_stats_error(MSGPACK_STATS_EDEPTH), luaL_error(L, "[msgpack error]: The maximum user-defined parsing depth was exceeded.");
+    /* 每个元素至少占用`1`字节: 元素数量不可能超过剩余的字节数, 不需要为此预先分配内存. */
+    if (kind == MSGPACK_KIND_ARRAY) {
+      msgpack_dec_need(count, "array");
+    } else {
+      msgpack_dec_need((size_t)count * 2, "map");
+    }
+    if (D->max_elements || D->max_memory)
+      msgpack_dec_tablelimit(L, D, kind, count);
+    luaL_checkstack(L, 3, "[msgpack decode]: lua stack overflow.");
+    if (kind == MSGPACK_KIND_ARRAY && D->typed && count >= D->typed && (len = msgpack_dec_typed(L, buffer, bsize, count)))
+      goto value;
+    if (kind == MSGPACK_KIND_ARRAY) {
+      lua_createtable(L, count, 0);
+      luaL_setmetatable(L, "lua_List");
+    } else {
+      lua_createtable(L, 0, count);
+    }
+    msgpack_stats_add(tables, 1);
+    msgpack_stats_max(max_depth, level + depth);
+    if (count) {
+      if (depth == cap) {
+        /* 栈帧不足: 扩展到`userdata`中 */
+        msgpack_DecFrame *nframes = lua_newuserdata(L, sizeof(msgpack_DecFrame) * cap * 2);
+        memcpy(nframes, frames, sizeof(msgpack_DecFrame) * cap);
+        if (frames == stack)
+          lua_insert(L, base + 1);
+        else
+          lua_replace(L, base + 1);
+        frames = nframes; cap *= 2;
+      }
+      frames[depth].count = count;
+      frames[depth].idx = kind == MSGPACK_KIND_ARRAY ? 1 : 0;
+      frames[depth].kind = kind;
+      depth++;
+      continue;
     }
-    else // type == MSG_TYPE_MAP32
+    goto complete;
+
+  value:
+    buffer += len; bsize -= len;
+
+  complete:
+    /* 当前值已完成: 赋值给外层容器, 外层容器也完成时继续向上. */
+    while (depth)
     {
-      if (bsize < 5)
-        return luaL_error(L, "[msgpack decode]: Insufficient remaining byte array for map32.");
-      uint32_t l = *(uint32_t*)(buffer + 1); xrio_ntoh32(&l); len = l;
-      buffer += 5; bsize -= 5;
+      msgpack_DecFrame *F = &frames[depth - 1];
+      if (F->kind == MSGPACK_KIND_ARRAY) {
+        lua_rawseti(L, -2, F->idx++);
+      } else if (!F->idx) {
+        F->idx = 1;   /* `key`已完成, 继续解码`value` */
+        break;
+      } else {
+        lua_rawset(L, -3);
+        F->idx = 0;
+      }
+      if (--F->count)
+        break;
+      depth--;
     }
+    if (!depth)
+      break;
   }
-  else if (type >= 0x80 && type <= 0x8f)  // type == `fixmap`
+  if (frames != stack)
+    lua_remove(L, base + 1);
+  return buffer - start;
+}
+
+/* 解码任意一个值并压入栈顶, 返回消耗的字节数. */
+int msgpack_dec_value(lua_State *L, msgpack_Decoder *D, int level, const char *buffer, size_t bsize) {
+  size_t size = msgpack_dec_iter(L, D, level + 1, buffer, bsize);
+  if (level == 0)
+    msgpack_stats_message(0, size);
+  return size;
+}
+
+int msgpack_dec_array(lua_State *L, msgpack_Decoder *D, int level, const char *buffer, size_t bsize) {
+  if (bsize == 0 || msgpack_leads[*(const uint8_t*)buffer].kind != MSGPACK_KIND_ARRAY)
+    return luaL_error(L, "[msgpack decode]: unknown byte type.");
+  return msgpack_dec_iter(L, D, level, buffer, bsize);
+}
+
+/* 只接受`Map`或`Array` */
+int msgpack_dec_map(lua_State *L, msgpack_Decoder *D, int level, const char *buffer, size_t bsize) {
+  if (bsize == 0 || msgpack_leads[*(const uint8_t*)buffer].kind == MSGPACK_KIND_SCALAR)
+    return luaL_error(L, "[msgpack decode]: unknown byte type.");
+  return msgpack_dec_iter(L, D, level, buffer, bsize);
+}
+
+/* 解析一个值的头部(类型、头部长度、内容长度与元素数量), 不会读取头部之后的内容. */
+int msgpack_scan_head(const char *buffer, size_t bsize, msgpack_Head *H) {
+  if (bsize == 0)
+    return MSGPACK_SCAN_AGAIN;
+  uint8_t t = *buffer;
+  const msgpack_Lead *d = &msgpack_leads[t];
+  if (d->op == MSGPACK_OP_INVALID)
+    return MSGPACK_SCAN_EBYTE;
+  H->type = t; H->kind = d->kind; H->hlen = d->hlen + d->lbytes; H->payload = 0; H->count = 0;
+  if (bsize < H->hlen)
+    return MSGPACK_SCAN_AGAIN;
+  uint64_t len;
+  switch (d->lbytes)
   {
-    buffer++; bsize--; len = type - 0x80;
+    case 0: len = d->inl; break;
+    case 1: len = *(uint8_t*)(buffer + 1); break;
+    case 2: len = xrio_load16(buffer + 1); break;
+    default: len = xrio_load32(buffer + 1); break;
   }
+  if (H->kind == MSGPACK_KIND_SCALAR)
+    H->payload = len;
   else
-    return luaL_error(L, "[msgpack decode]: unknown byte type.");
+    H->count = len;
+  return MSGPACK_SCAN_DONE;
+}
 
-  if (level >= USE_MSGPACK_MAX_STACK)
-    return luaL_error(L, "[msgpack error]: The maximum user-defined parsing depth was exceeded.");
+/* 栈满时扩展为原来的两倍: `fixed`为初始的栈上数组, 之后改用堆内存; 内存不足时返回`0`. */
+static int msgpack_stack_grow(void **stack, void *fixed, int *cap, size_t esize) {
+  void *nstack = xrio_realloc(*stack == fixed ? NULL : *stack, esize * *cap * 2);
+  if (!nstack)
+    return 0;
+  if (*stack == fixed)
+    memcpy(nstack, fixed, esize * *cap);
+  *stack = nstack; *cap *= 2;
+  return 1;
+}
 
-  size_t offset;
-  // xrio_log("map 长度为: %u\n", len);
-  lua_createtable(L, 0, len);
-  while (len--)
+/* 初始化扫描器(不限制资源), 限制可以在之后直接设置 */
+void msgpack_scan_setup(msgpack_Scanner *S) {
+  S->max_depth = 0; S->max_string = S->max_elements = S->max_memory = 0;
+  S->stack = S->fixed; S->cap = USE_MSGPACK_MAX_STACK;
+  msgpack_scan_init(S);
+}
+
+void msgpack_scan_free(msgpack_Scanner *S) {
+  if (S->stack != S->fixed)
+    xrio_free(S->stack);
+  S->stack = S->fixed; S->cap = USE_MSGPACK_MAX_STACK;
+}
+
+/* 按解码时的估计值检查资源限制, `commit`为`0`时只检查不计入. */
+static inline int msgpack_scan_limit(msgpack_Scanner *S, const msgpack_Head *H, int commit) {
+  uint8_t op = msgpack_leads[H->type].op;
+  size_t elements = S->elements, memory = S->memory;
+  if (H->kind != MSGPACK_KIND_SCALAR) {
+    elements += H->count;
+    if (S->max_elements && elements > S->max_elements)
+      return MSGPACK_SCAN_ELCOUNT;
+    memory += MSGPACK_MEM_TABLE + H->count * (H->kind == MSGPACK_KIND_MAP ? MSGPACK_MEM_NODE : MSGPACK_MEM_SLOT);
+  } else if ((op >= MSGPACK_OP_FIXSTR && op <= MSGPACK_OP_STR32) || op == MSGPACK_OP_EXT) {
+    if (S->max_string && H->payload > S->max_string)
+      return MSGPACK_SCAN_ELSTRING;
+    memory += MSGPACK_MEM_STRING + H->payload;
+  }
+  if (S->max_memory && memory > S->max_memory)
+    return MSGPACK_SCAN_ELMEMORY;
+  if (commit) {
+    S->elements = elements; S->memory = memory;
+  }
+  return MSGPACK_SCAN_DONE;
+}
+
+/*
+  扫描出一个完整顶层值的边界, 不会创建任何`Lua`值.
+  扫描状态保存在`S`内, 数据不足时返回`MSGPACK_SCAN_AGAIN`, 补充数据后
+  使用同一个`S`再次调用即可从上次停止的位置继续, 已扫描过的字节不会被重复扫描.
+  资源限制在读到头部时立即检查, 所以声明了超大长度的头部不会导致继续等待(缓存)数据.
+*/
+int msgpack_scan(msgpack_Scanner *S, const char *buffer, size_t bsize) {
+  msgpack_Head H;
+  int max_depth = S->max_depth > 0 ? S->max_depth : USE_MSGPACK_MAX_STACK - 1;
+  int limited = S->max_string || S->max_elements || S->max_memory;
+  while (S->pos < bsize)
   {
-    
-    /* key type */
-    uint8_t kt = *buffer;
-    switch (kt)
-    {
-      /* 注意: 为了安全、性能、稳定, 不建议字符串`key`的数量大于`65535` */
-      case MSG_TYPE_BIN8: case MSG_TYPE_STR8:
-        offset = msgpack_dec_string(L, 1, ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_BIN16: case MSG_TYPE_STR16:
-        offset = msgpack_dec_string(L, 2, ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-#if defined(USE_MSGPACK_KEY32) /* 当然, 也可以要求主动开启4字节的超大`KEY`支持 */
-      case MSG_TYPE_BIN32: case MSG_TYPE_STR32:
-        offset = msgpack_dec_string(L, 4, ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
+    int ret = msgpack_scan_head(buffer + S->pos, bsize - S->pos, &H);
+    if (ret != MSGPACK_SCAN_DONE)
+      return ret;
+    if (H.kind != MSGPACK_KIND_SCALAR && S->depth + 1 > max_depth)
+      return MSGPACK_SCAN_EDEPTH;
+    /* 数据不足时下次会重新读取同一个头部, 所以只在内容完整后计入 */
+    int complete = bsize - S->pos - H.hlen >= H.payload;
+    if (limited && (ret = msgpack_scan_limit(S, &H, complete)) != MSGPACK_SCAN_DONE)
+      return ret;
+    if (!complete)
+      return MSGPACK_SCAN_AGAIN;
+    S->pos += H.hlen + H.payload;
+
+    /* 非空容器: 压栈等待子元素 */
+    if (H.count) {
+      if (S->depth == S->cap && !msgpack_stack_grow((void**)&S->stack, S->fixed, &S->cap, sizeof(uint64_t)))
+        return MSGPACK_SCAN_ENOMEM;
+      S->stack[S->depth++] = H.kind == MSGPACK_KIND_MAP ? H.count * 2 : H.count;
+      continue;
+    }
+
+    /* 一个值已完整: 逐层出栈 */
+    while (S->depth > 0 && --S->stack[S->depth - 1] == 0)
+      S->depth--;
+    if (S->depth == 0)
+      return MSGPACK_SCAN_DONE;
+  }
+  return MSGPACK_SCAN_AGAIN;
+}
+
+/*
+  计算一个完整的值(任意类型)的编码长度, 只检查结构是否完整.
+  只需要记录剩余未扫描的值的数量, 所以不受嵌套深度限制, 也不会创建任何`Lua`值.
+*/
+int msgpack_sizeof(const char *buffer, size_t bsize, size_t *size) {
+  msgpack_Head H; size_t pos = 0; uint64_t remain = 1;
+  while (remain--)
+  {
+    int ret = msgpack_scan_head(buffer + pos, bsize - pos, &H);
+    if (ret != MSGPACK_SCAN_DONE)
+      return ret;
+    if (bsize - pos - H.hlen < H.payload)
+      return MSGPACK_SCAN_AGAIN;
+    pos += H.hlen + H.payload;
+    remain += H.kind == MSGPACK_KIND_MAP ? H.count * 2 : H.count;
+  }
+  *size = pos;
+  return MSGPACK_SCAN_DONE;
+}
+
+/* 跳过一个完整的值, 返回其编码长度; 数据不足或遇到不支持的类型时返回`0`. */
+size_t msgpack_skip(const char *buffer, size_t bsize) {
+  size_t size;
+  if (msgpack_sizeof(buffer, bsize, &size) != MSGPACK_SCAN_DONE)
+    return 0;
+  return size;
+}
+
+/* 检查浮点数是否为`INF`或`NaN` */
+static inline int msgpack_validate_float(uint8_t t, const char *buffer) {
+  if (t == MSG_TYPE_FLOAT32) {
+    xrio_u32_t v; memcpy(v.ptr, buffer, 4); xrio_ntoh32((uint32_t*)v.ptr);
+    return !isnan(v.n) && !isinf(v.n);
+  }
+  xrio_u64_t v; memcpy(v.ptr, buffer, 8); xrio_ntoh64((uint64_t*)v.ptr);
+  return !isnan(v.n) && !isinf(v.n);
+}
+
+typedef struct msgpack_ValidFrame {
+  uint64_t remain; uint8_t kind;
+} msgpack_ValidFrame;
+
+/*
+  校验`buffer`处是否为一个`msgpack_dec_value`能够完整解码的值(包括`key`类型、浮点数、字符串长度与深度限制),
+  成功时通过`size`返回其编码长度. 整个过程只遍历字节, 不会创建任何`Lua`值(可以在其它线程中调用).
+  `max_depth`与解码的选项相同, 为`0`时使用`USE_MSGPACK_MAX_STACK - 1`; 嵌套超出栈上数组时改用堆内存.
+*/
+int msgpack_validate(const char *buffer, size_t bsize, int max_depth, size_t *size) {
+  msgpack_Head H; size_t pos = 0; int depth = 0; int ret;
+  msgpack_ValidFrame fixed[USE_MSGPACK_MAX_STACK];
+  msgpack_ValidFrame *stack = fixed; int cap = USE_MSGPACK_MAX_STACK;
+  if (max_depth <= 0)
+    max_depth = USE_MSGPACK_MAX_STACK - 1;
+  for (;;)
+  {
+    if ((ret = msgpack_scan_head(buffer + pos, bsize - pos, &H)) != MSGPACK_SCAN_DONE)
+      break;
+    /* `Map`内剩余数量为偶数时, 当前值是`key`. */
+    if (depth > 0 && stack[depth - 1].kind == MSGPACK_KIND_MAP && !(stack[depth - 1].remain & 1) && !msgpack_leads[H.type].key) {
+      ret = MSGPACK_SCAN_EKEY;
+      break;
+    }
+    if (bsize - pos - H.hlen < H.payload) {
+      ret = MSGPACK_SCAN_AGAIN;
+      break;
+    }
+    if ((H.type == MSG_TYPE_FLOAT32 || H.type == MSG_TYPE_FLOAT64) && !msgpack_validate_float(H.type, buffer + pos + 1)) {
+      ret = MSGPACK_SCAN_EFLOAT;
+      break;
+    }
+#if !defined(USE_MSGPACK_STR24)
+    if ((H.type == MSG_TYPE_STR32 || H.type == MSG_TYPE_BIN32) && H.payload >= 16777216) {
+      ret = MSGPACK_SCAN_ESTRING;
+      break;
+    }
 #endif
-      case MSG_TYPE_FLOAT32: case MSG_TYPE_FLOAT64:
-        offset = msgpack_dec_number(L, 4 << (kt - MSG_TYPE_FLOAT32), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_UINT8: case MSG_TYPE_UINT16: case MSG_TYPE_UINT32: case MSG_TYPE_UINT64:
-        offset = msgpack_dec_uint(L, 1 << (kt - MSG_TYPE_UINT8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
+    pos += H.hlen + H.payload;
+
+    if (H.kind != MSGPACK_KIND_SCALAR) {
+      if (depth + 1 > max_depth) {
+        ret = MSGPACK_SCAN_EDEPTH;
         break;
-      /* 注意: 某些编程语言的`number`会转换为`str`, 但是`Lua`内则不转换. */
-      default:
-        if (kt <= 0x7f || kt >= 0xe0) {     /* fix uint8 */
-          offset = msgpack_dec_fixint(L, kt);
-          buffer += offset; bsize -= offset;
-          break;
-        }
-        else if (kt >= 0xa0 && kt <= 0xbf) /* fix str */
-        {
-          offset = msgpack_dec_string(L, kt, ++buffer, --bsize);
-          buffer += offset; bsize -= offset;
+      }
+      if (H.count) {
+        if (depth == cap && !msgpack_stack_grow((void**)&stack, fixed, &cap, sizeof(msgpack_ValidFrame))) {
+          ret = MSGPACK_SCAN_ENOMEM;
           break;
         }
-#if !defined(USE_MSGPACK_KEY32) /* 如果不支持32位key, 增加一些友好提示. */
-        if (kt == MSG_TYPE_BIN32 || kt == MSG_TYPE_STR32)
-          return luaL_error(L, "[msgpack decode]: The 32-bit map key is not supported.");
-#endif
-        return luaL_error(L, "[msgpack decode]: The map key type is not supported.(%d)", kt);
+        stack[depth].remain = H.kind == MSGPACK_KIND_MAP ? H.count * 2 : H.count;
+        stack[depth++].kind = H.kind;
+        continue;
+      }
     }
 
-    /* value type */
-    uint8_t vt = *buffer;
-    switch (vt)
-    {
-      case MSG_TYPE_NIL:
-        offset = msgpack_dec_nil(L);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_TRUE: case MSG_TYPE_FALSE:
-        offset = msgpack_dec_boolean(L, vt == MSG_TYPE_TRUE);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_BIN8: case MSG_TYPE_BIN16: case MSG_TYPE_BIN32:
-        offset = msgpack_dec_string(L, 1 << (vt - MSG_TYPE_BIN8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_STR8: case MSG_TYPE_STR16: case MSG_TYPE_STR32:
-        offset = msgpack_dec_string(L, 1 << (vt - MSG_TYPE_STR8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_FLOAT32: case MSG_TYPE_FLOAT64:
-        offset = msgpack_dec_number(L, 4 << (vt - MSG_TYPE_FLOAT32), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_UINT8: case MSG_TYPE_UINT16: case MSG_TYPE_UINT32: case MSG_TYPE_UINT64:
-        offset = msgpack_dec_uint(L, 1 << (vt - MSG_TYPE_UINT8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_INT8: case MSG_TYPE_INT16: case MSG_TYPE_INT32: case MSG_TYPE_INT64:
-        offset = msgpack_dec_int(L, 1 << (vt - MSG_TYPE_INT8), ++buffer, --bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_ARR16: case MSG_TYPE_ARR32:            /* 定长数组 */
-        offset = msgpack_dec_array(L, level + 1, buffer, bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      case MSG_TYPE_MAP16: case MSG_TYPE_MAP32:            /* 定长字典 */
-        offset = msgpack_dec_map(L, level + 1, buffer, bsize);
-        buffer += offset; bsize -= offset;
-        break;
-      default:
-        if (vt <= 0x7f || vt >= 0xe0) {     /* fix uint8 */
-          offset = msgpack_dec_fixint(L, vt);
-          buffer += offset; bsize -= offset;
-          break;
-        }
-        else if (vt >= 0xa0 && vt <= 0xbf) /* fix str */
-        {
-          offset = msgpack_dec_string(L, vt, ++buffer, --bsize);
-          buffer += offset; bsize -= offset;
-          break;
-        }
-        else if (vt >= 0x90 && vt <= 0x9f) /* fix array */
-        {
-          offset = msgpack_dec_array(L, level + 1, buffer, bsize);
-          buffer += offset; bsize -= offset;
-          break;
-        }
-        else if (vt >= 0x80 && vt <= 0x8f) /* fix map */
-        {
-          offset = msgpack_dec_map(L, level + 1, buffer, bsize);
-          buffer += offset; bsize -= offset;
-          break;
-        }
-        return luaL_error(L, "[msgpack decode]: The map value type is not supported.(%d)", vt);
+    /* 一个值已完整: 逐层出栈 */
+    while (depth > 0 && --stack[depth - 1].remain == 0)
+      depth--;
+    if (depth == 0) {
+      *size = pos;
+      break;
     }
-    lua_rawset(L, -3);
   }
-  // xrio_log("end size = %zu\n", bsize);
-  return expend - bsize;
+  if (stack != fixed)
+    xrio_free(stack);
+  return ret;
+}
+
+const char* msgpack_scan_strerror(int code) {
+  switch (code)
+  {
+    case MSGPACK_SCAN_EBYTE:
+      return "[msgpack decode]: unknown byte type.";
+    case MSGPACK_SCAN_EDEPTH:
+      return "[msgpack error]: The maximum user-defined parsing depth was exceeded.";
+    case MSGPACK_SCAN_EKEY:
+      return "[msgpack decode]: The map key type is not supported.";
+    case MSGPACK_SCAN_EFLOAT:
+      return "[msgpack decode]: `msgpack_dec_float` has got `INF` or `NaN` key.";
+    case MSGPACK_SCAN_ESTRING:
+      return "[msgpack decode]: The string exceeds the parse length.";
+    case MSGPACK_SCAN_ELSTRING:
+      return "[msgpack error]: The maximum user-defined string length was exceeded.";
+    case MSGPACK_SCAN_ELCOUNT:
+      return "[msgpack error]: The maximum user-defined number of elements was exceeded.";
+    case MSGPACK_SCAN_ELMEMORY:
+      return "[msgpack error]: The maximum user-defined memory usage was exceeded.";
+    case MSGPACK_SCAN_ENOMEM:
+      return "[msgpack error]: out of memory.";
+    default:
+      return "[msgpack decode]: Insufficient remaining byte array.";
+  }
+}
+
+/* 初始化`key`缓存, 并在栈顶创建用于锚定缓存字符串的表. */
+void msgpack_keycache_init(lua_State *L, msgpack_KeyCache *K) {
+  memset(K->slots, 0, sizeof(K->slots));
+  lua_createtable(L, MSGPACK_KEYCACHE_SIZE, 0);
+  K->anchor = lua_gettop(L);
+}
+
+/* 获取正整数选项, 未指定时返回`0` */
+static inline size_t msgpack_decode_limit(lua_State *L, int idx, const char *name) {
+  lua_getfield(L, idx, name);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  int isnum; lua_Integer limit = lua_tointegerx(L, -1, &isnum);
+  if (!isnum || limit < 1)
+    luaL_error(L, "[msgpack error]: `%s` must be a positive integer.", name);
+  lua_pop(L, 1);
+  return (size_t)limit;
+}
+
+static inline int msgpack_decode_depth(lua_State *L, int idx) {
+  size_t max_depth = msgpack_decode_limit(L, idx, "max_depth");
+  if (max_depth > INT32_MAX)
+    luaL_error(L, "[msgpack error]: `max_depth` must be a positive integer.");
+  return (int)max_depth;
+}
+
+/* 解析资源限制选项: { max_depth = ?, max_elements = ?, max_string = ?, max_memory = ? } */
+void msgpack_decode_limits(lua_State *L, int idx, msgpack_Decoder *D) {
+  D->max_depth = msgpack_decode_depth(L, idx);
+  D->max_elements = msgpack_decode_limit(L, idx, "max_elements");
+  D->max_string = msgpack_decode_limit(L, idx, "max_string");
+  D->max_memory = msgpack_decode_limit(L, idx, "max_memory");
+  D->elements = D->memory = 0;
+}
+
+/* 只解析`max_depth`选项(`validate`与`index`使用), 没有选项时返回`0` */
+int msgpack_decode_maxdepth(lua_State *L, int idx) {
+  if (lua_isnoneornil(L, idx))
+    return 0;
+  luaL_checktype(L, idx, LUA_TTABLE);
+  return msgpack_decode_depth(L, idx);
+}
+
+/* 解析解码选项: { key_cache = true } */
+static inline void msgpack_decode_options(lua_State *L, int idx, msgpack_Decoder *D, msgpack_KeyCache *K) {
+  memset(D, 0, sizeof(msgpack_Decoder));
+  if (lua_isnoneornil(L, idx))
+    return;
+  luaL_checktype(L, idx, LUA_TTABLE);
+  lua_getfield(L, idx, "key_cache");
+  int key_cache = lua_toboolean(L, -1); lua_pop(L, 1);
+  if (key_cache) {
+    msgpack_keycache_init(L, K);
+    D->keys = K;
+  }
+  msgpack_decode_limits(L, idx, D);
+  /* `typed_array = true`或最小元素数量(`0`与`false`相同, 表示不启用) */
+  lua_getfield(L, idx, "typed_array");
+  if (lua_isinteger(L, -1)) {
+    lua_Integer typed = lua_tointeger(L, -1);
+    if (typed < 0)
+      luaL_error(L, "[msgpack error]: `typed_array` must be a boolean or a non-negative integer.");
+    D->typed = (size_t)typed;
+  } else
+    D->typed = lua_toboolean(L, -1) ? 1 : 0;
+  lua_pop(L, 1);
+}
+
+/* 获取`pos`参数(从`1`开始), 返回对应的偏移量. */
+size_t msgpack_decode_pos(lua_State *L, int idx, size_t bsize) {
+  lua_Integer pos = luaL_optinteger(L, idx, 1);
+  luaL_argcheck(L, pos >= 1 && (lua_Unsigned)pos <= bsize, idx, "position out of range");
+  return pos - 1;
 }
 
 int msgpack_decode_init(lua_State *L) {
@@ -421,8 +722,12 @@ int msgpack_decode_init(lua_State *L) {
   const char *buffer = luaL_checklstring(L, 1, &bsize);
   if (!buffer || bsize < 1)
     return luaL_error(L, "[msgpack error]: decode buffer was empty");
-  msgpack_dec_map(L, 1, buffer, bsize);
-  return 1;
+  size_t offset = msgpack_decode_pos(L, 2, bsize);
+  msgpack_Decoder D; msgpack_KeyCache K;
+  msgpack_decode_options(L, 3, &D, &K);
+  offset += msgpack_dec_value(L, &D, 0, buffer + offset, bsize - offset);
+  lua_pushinteger(L, offset + 1);
+  return 2;
 }
 
 int lmsgpack_decode(lua_State *L){
@@ -430,13 +735,82 @@ int lmsgpack_decode(lua_State *L){
   const char *buffer = luaL_checklstring(L, 1, &bsize);
   if (!buffer || bsize < 1)
     return luaL_error(L, "[msgpack error]: decode buffer was empty");
-  lua_settop(L, 1);
+  lua_settop(L, 3);
   /* 使用保护模式调用 */
   lua_pushcfunction(L, msgpack_decode_init);
   lua_pushvalue(L, 1);
-  if (LUA_OK == lua_pcall(L, 1, 1, 0))
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, 3);
+  if (LUA_OK == lua_pcall(L, 3, 2, 0))
+    return 2;
+  lua_pushboolean(L, 0);
+  lua_pushvalue(L, -2);
+  return 2;
+}
+
+/* 连续解码`buffer`内首尾相连的所有值 */
+int msgpack_decode_all_init(lua_State *L) {
+  size_t bsize;
+  const char *buffer = luaL_checklstring(L, 1, &bsize);
+  size_t offset = 0; lua_Integer idx = 1;
+  msgpack_Decoder D; msgpack_KeyCache K;
+  msgpack_decode_options(L, 2, &D, &K);
+  lua_createtable(L, 0, 0);
+  while (offset < bsize)
+  {
+    offset += msgpack_dec_value(L, &D, 0, buffer + offset, bsize - offset);
+    lua_rawseti(L, -2, idx++);
+  }
+  return 1;
+}
+
+int lmsgpack_decode_all(lua_State *L){
+  luaL_checkstring(L, 1);
+  lua_settop(L, 2);
+  /* 使用保护模式调用 */
+  lua_pushcfunction(L, msgpack_decode_all_init);
+  lua_pushvalue(L, 1);
+  lua_pushvalue(L, 2);
+  if (LUA_OK == lua_pcall(L, 2, 1, 0))
     return 1;
   lua_pushboolean(L, 0);
   lua_pushvalue(L, -2);
   return 2;
 }
+
+/* 校验消息: msgpack.validate(buffer [, pos [, { max_depth = ? }]]), 成功返回编码长度, 失败返回`false`与错误信息. */
+int lmsgpack_validate(lua_State *L) {
+  size_t bsize; size_t size;
+  const char *buffer = luaL_checklstring(L, 1, &bsize);
+  if (!buffer || bsize < 1)
+    return luaL_error(L, "[msgpack error]: decode buffer was empty");
+  size_t offset = msgpack_decode_pos(L, 2, bsize);
+  int max_depth = msgpack_decode_maxdepth(L, 3);
+  int ret = msgpack_validate(buffer + offset, bsize - offset, max_depth, &size);
+  if (ret != MSGPACK_SCAN_DONE) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, msgpack_scan_strerror(ret));
+    return 2;
+  }
+  lua_pushinteger(L, size);
+  return 1;
+}
+
+/* 获取消息长度: msgpack.sizeof(buffer [, pos]), 数据不完整时返回`nil`, 遇到不支持的类型时返回`false`与错误信息. */
+int lmsgpack_sizeof(lua_State *L) {
+  size_t bsize; size_t size;
+  const char *buffer = luaL_checklstring(L, 1, &bsize);
+  if (!buffer || bsize < 1)
+    return luaL_error(L, "[msgpack error]: decode buffer was empty");
+  size_t offset = msgpack_decode_pos(L, 2, bsize);
+  int ret = msgpack_sizeof(buffer + offset, bsize - offset, &size);
+  if (ret == MSGPACK_SCAN_AGAIN)
+    return 0;
+  if (ret != MSGPACK_SCAN_DONE) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, msgpack_scan_strerror(ret));
+    return 2;
+  }
+  lua_pushinteger(L, size);
+  return 1;
+}
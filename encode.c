@@ -1,7 +1,8 @@
 #include "msgpack.h"
+#include <errno.h>
+#include <unistd.h>
 
-int msgpack_enc_map(lua_State *L, xrio_Buffer *B);
-int msgpack_enc_array(lua_State *L, xrio_Buffer *B);
+int msgpack_enc_array(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int level);
 
 /* 编码`Nil` */
 void msgpack_enc_nil(xrio_Buffer *B) {
@@ -92,106 +93,288 @@ void msgpack_enc_integer(xrio_Buffer *B, lua_Integer i) {
   return;
 }
 
-int msgpack_enc_string(lua_State *L, xrio_Buffer *B, const char*buffer, size_t bsize) {
+/* 写入字符串头部, 返回头部长度. */
+int msgpack_enc_strhead(lua_State *L, xrio_Buffer *B, size_t bsize) {
   if (bsize <= 31) {
     xrio_addchar(B, 0xa0 + bsize); /* fixstr start position + 数量 */
-    xrio_addlstring(B, buffer, bsize);
-    return bsize + 1;
+    return 1;
   }
   if (bsize <= UINT8_MAX) {
     xrio_addchar(B, MSG_TYPE_STR8);
     xrio_addchar(B, (uint8_t)bsize);
-    xrio_addlstring(B, buffer, bsize);
-    return bsize + 2;
+    return 2;
   }
   if (bsize <= UINT16_MAX) {
+    uint16_t data = bsize;
+    xrio_hton16(&data);
     xrio_addchar(B, MSG_TYPE_STR16);
-    return bsize + 3;
+    xrio_addlstring(B, (char*)&data, 2);
+    return 3;
   }
   if (bsize <= UINT32_MAX) {
+    uint32_t data = bsize;
+    xrio_hton32(&data);
     xrio_addchar(B, MSG_TYPE_STR32);
-    return bsize + 5;
+    xrio_addlstring(B, (char*)&data, 4);
+    return 5;
   }
-  return luaL_error(L, "[msgpack encode]: string was too long(%zu).", bsize);
+  return msgpack_stats_error(MSGPACK_STATS_EENCODE), luaL_error(L, "[msgpack encode]: string was too long(%zu).", bsize);
 }
 
-/* 编码`Array` */
-int msgpack_enc_array(lua_State *L, xrio_Buffer *root) {
-  int kt; int vt; size_t count = 0;
-  xrio_Buffer B; xrio_buffinit(L, &B);
-  lua_pushnil(L);
-  while (lua_next(L, -2))
-  {
-    kt = lua_type(L, -2);
-    if (kt != LUA_TNUMBER || lua_tointeger(L, -2) - count != 1) {
-      lua_pop(L, 2); B.L = NULL; xrio_pushresult(&B);
-      return -1; /* 并非纯数组 */
-    }
+int msgpack_enc_string(lua_State *L, xrio_Buffer *B, const char*buffer, size_t bsize) {
+  int hlen = msgpack_enc_strhead(L, B, bsize);
+  xrio_addlstring(B, buffer, bsize);
+  return bsize + hlen;
+}
 
-    /* 获取`Value`字段类型 */
-    vt = lua_type(L, -1);
-    switch (vt)
-    {
-      case LUA_TBOOLEAN:
-        msgpack_enc_boolean(&B, lua_toboolean(L, -1));
-        break;
-      case LUA_TLIGHTUSERDATA:
-        msgpack_enc_nil(&B);
-        break;
-      case LUA_TSTRING:
-        {
-          size_t bsize; const char* buffer = luaL_checklstring(L, -1, &bsize);
-          msgpack_enc_string(L, &B, buffer, bsize);
-        }
-        break;
-      case LUA_TNUMBER:
-        if (lua_isinteger(L, -1))
-          msgpack_enc_integer(&B, lua_tointeger(L, -1));  
-        else
-          msgpack_enc_number(&B, lua_tonumber(L, -1));
-        break;
-      case LUA_TTABLE:
-        msgpack_enc_map(L, &B);
-        break;
-      default:
-        B.L = NULL; xrio_pushresult(&B);
-        return luaL_error(L, "[msgpack encode]: Unsupported array value type `%s`.", lua_typename(L, vt));
-    }
-    lua_pop(L, 1);
-    count++;
+/*
+  编码`Map`的字符串`key`: 以字符串对象的地址为索引缓存完整的编码结果(头部 + 内容),
+  命中时只需一次内存拷贝. 缓存的字符串会被锚定, 所以地址在缓存有效期间不会被复用.
+*/
+static inline void msgpack_enc_key(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int idx, const char *buffer, size_t bsize) {
+  msgpack_EncKeyCache *K = E->keys;
+  uintptr_t addr = (uintptr_t)buffer;
+  uint32_t slot = ((addr >> 4) ^ (addr >> 12)) & (MSGPACK_ENCKEY_SIZE - 1);
+  if (K->slots[slot].key == buffer) {
+    xrio_addlstring(B, K->slots[slot].data, K->slots[slot].len);
+    return;
   }
+  size_t pos = xrio_buffgetidx(B);
+  size_t len = msgpack_enc_string(L, B, buffer, bsize);
+  memcpy(K->slots[slot].data, B->b + pos, len);
+  K->slots[slot].len = len;
+  K->slots[slot].key = buffer;
+  lua_pushvalue(L, idx);
+  lua_rawseti(L, E->anchor, slot + 1);
+}
 
-  if (count <= 15)
-    xrio_addchar(root, 0x90 + count);
-  else if(count <= UINT16_MAX)
-    xrio_addchar(root, MSG_TYPE_ARR16);
-  else if(count <= UINT32_MAX)
-    xrio_addchar(root, MSG_TYPE_ARR32);
-  else {
-    B.L = NULL; xrio_pushresult(&B);
-    return luaL_error(L, "[msgpack encode]: Invalid array items `%zu`.", count);
+/* 获取全局的`key`缓存与扩展类型注册表, 并将锚定表与扩展类型的元表索引依次压入栈顶. */
+void msgpack_encoder_init(lua_State *L, msgpack_Encoder *E) {
+  lua_getfield(L, LUA_REGISTRYINDEX, "lua_EncKeyCache");
+  E->keys = lua_touserdata(L, -1);
+  lua_getuservalue(L, -1);
+  lua_remove(L, -2);
+  E->anchor = lua_gettop(L);
+  lua_getfield(L, LUA_REGISTRYINDEX, "lua_ExtRegistry");
+  E->exts = lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  lua_getfield(L, LUA_REGISTRYINDEX, "lua_ExtMeta");
+  E->extmeta = lua_gettop(L);
+  E->gather = NULL;
+  E->canonical = 0;
+}
+
+/* 清空全局的`key`缓存 */
+int lmsgpack_clear_key_cache(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, "lua_EncKeyCache");
+  msgpack_EncKeyCache *K = lua_touserdata(L, -1);
+  memset(K, 0, sizeof(msgpack_EncKeyCache));
+  lua_createtable(L, MSGPACK_ENCKEY_SIZE, 0);
+  lua_setuservalue(L, -2);
+  lua_pop(L, 1);
+  return 0;
+}
+
+/* 创建全局的`key`缓存(保存在注册表中) */
+void msgpack_enckey_meta(lua_State *L) {
+  msgpack_EncKeyCache *K = lua_newuserdata(L, sizeof(msgpack_EncKeyCache));
+  memset(K, 0, sizeof(msgpack_EncKeyCache));
+  lua_createtable(L, MSGPACK_ENCKEY_SIZE, 0);
+  lua_setuservalue(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, "lua_EncKeyCache");
+}
+
+/* 写入`Array`/`Map`头部(数量已知) */
+int msgpack_enc_length(lua_State *L, xrio_Buffer *B, size_t count, uint8_t fix, uint8_t t16, uint8_t t32) {
+  if (count <= 15) {
+    xrio_addchar(B, fix + count);
+    return 1;
+  }
+  if (count <= UINT16_MAX) {
+    uint16_t data = count;
+    xrio_hton16(&data);
+    xrio_addchar(B, t16);
+    xrio_addlstring(B, (char*)&data, 2);
+    return 3;
+  }
+  if (count <= UINT32_MAX) {
+    uint32_t data = count;
+    xrio_hton32(&data);
+    xrio_addchar(B, t32);
+    xrio_addlstring(B, (char*)&data, 4);
+    return 5;
   }
+  return msgpack_stats_error(MSGPACK_STATS_EENCODE), luaL_error(L, "[msgpack encode]: Invalid %s items `%zu`.", fix == 0x90 ? "array" : "map", count);
+}
 
-  if (count && B.bidx)
-    xrio_addlstring(root, B.b, B.bidx);
+/* 回填`Map`头部: 编码前只预留`1`字节, 数量超出`fixmap`范围时才原地扩展. */
+static inline int msgpack_enc_header(lua_State *L, xrio_Buffer *B, size_t pos, size_t count) {
+  if (count <= 15) {
+    B->b[pos] = 0x80 + count;
+    return 1;
+  }
+  if (count <= UINT16_MAX) {
+    uint16_t data = count;
+    xrio_hton16(&data);
+    xrio_insertspace(B, pos + 1, 2);
+    B->b[pos] = MSG_TYPE_MAP16;
+    memcpy(B->b + pos + 1, &data, 2);
+    return 3;
+  }
+  if (count <= UINT32_MAX) {
+    uint32_t data = count;
+    xrio_hton32(&data);
+    xrio_insertspace(B, pos + 1, 4);
+    B->b[pos] = MSG_TYPE_MAP32;
+    memcpy(B->b + pos + 1, &data, 4);
+    return 5;
+  }
+  return msgpack_stats_error(MSGPACK_STATS_EENCODE), luaL_error(L, "[msgpack encode]: Invalid map items `%zu`.", count);
+}
 
-  B.L = NULL; xrio_pushresult(&B);
-  return 0;
+/* 空表只有在设置了`lua_List`元表时才会编码为数组 */
+static inline int msgpack_enc_islist(lua_State *L) {
+  if (lua_getmetatable(L, -1) == 0)
+    return 0;
+  luaL_getmetatable(L, "lua_List");
+  int is_list = lua_rawequal(L, -1, -2); lua_pop(L, 2);
+  return is_list;
 }
 
-/* 编码`Map` */
-int msgpack_enc_map(lua_State *L, xrio_Buffer *root) {
-  int kt; int vt; size_t count = 0;
-  if (lua_rawlen(L, -1) > 0) {
-    if (!msgpack_enc_array(L, root))
-      return 0;
-  } else if (lua_getmetatable(L, -1) == 1 && luaL_getmetatable(L, "lua_List")) {
-    int is_list = lua_rawequal(L, -1, -2); lua_pop(L, 2);
-    if (is_list && !msgpack_enc_array(L, root))
+/*
+  从`lua_next`刚给出的`key`开始继续遍历, 检查剩余的`key`是否恰好为`(i, n]`(之前已经给出了`1..i`).
+  返回时`key`与`value`都已出栈.
+*/
+static inline int msgpack_enc_seqrest(lua_State *L, lua_Integer i, lua_Integer n) {
+  lua_Integer k, rest = 0;
+  do {
+    lua_pop(L, 1);
+    if (!lua_isinteger(L, -1) || (k = lua_tointeger(L, -1)) <= i || k > n) {
+      lua_pop(L, 1);
       return 0;
+    }
+    rest++;
+  } while (lua_next(L, -2));
+  return rest == n - i;
+}
+
+/* 编码栈顶的`Value` */
+void msgpack_enc_value(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int level, const char *where) {
+  int vt = lua_type(L, -1);
+  switch (vt)
+  {
+    case LUA_TNIL:
+      msgpack_enc_nil(B);
+      break;
+    case LUA_TBOOLEAN:
+      msgpack_enc_boolean(B, lua_toboolean(L, -1));
+      break;
+    case LUA_TLIGHTUSERDATA:
+      msgpack_enc_nil(B);
+      break;
+    case LUA_TSTRING:
+      {
+        size_t bsize; const char* buffer = lua_tolstring(L, -1, &bsize);
+        if (E->gather && bsize >= E->gather->threshold)
+          msgpack_gather_string(L, E->gather, B, buffer, bsize);
+        else
+          msgpack_enc_string(L, B, buffer, bsize);
+      }
+      break;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, -1))
+        msgpack_enc_integer(B, lua_tointeger(L, -1));
+      else
+        msgpack_enc_number(B, lua_tonumber(L, -1));
+      break;
+    case LUA_TTABLE:
+      if (lua_getmetatable(L, -1)) {
+        int ext = msgpack_enc_ext(L, E, B);
+        lua_pop(L, 1);
+        if (ext)
+          break;
+      }
+      msgpack_enc_map(L, E, B, level + 1);
+      break;
+    case LUA_TUSERDATA:
+      if (lua_getmetatable(L, -1)) {
+        int ext = msgpack_enc_ext(L, E, B);
+        lua_pop(L, 1);
+        if (ext)
+          break;
+      }
+      /* fallthrough */
+    default:
+      msgpack_stats_error(MSGPACK_STATS_EENCODE), luaL_error(L, "[msgpack encode]: Unsupported %s value type `%s`.", where, lua_typename(L, vt));
+  }
+}
+
+/*
+  尝试将栈顶`Table`编码为`Array`, 不是纯数组时返回`-1`(缓冲区已回滚).
+  `lua_next`按`1, 2, ...`的顺序给出数组部分的元素, 所以纯数组在同一次遍历中完成判断与编码;
+  边界附近的元素也可能位于哈希部分(顺序不确定), 遇到乱序的`key`时检查剩余的`key`, 是纯数组则按下标编码剩余的元素.
+*/
+int msgpack_enc_array(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int level) {
+  lua_Integer n = lua_rawlen(L, -1), i = 0;
+  if (n == 0 && !msgpack_enc_islist(L))
+    return -1;
+  if (B->write) {
+    /* 直接写出时无法回滚, 预先检查 */
+    lua_pushnil(L);
+    if (lua_next(L, -2) && !msgpack_enc_seqrest(L, 0, n))
+      return msgpack_stats_add(array_fallbacks, n > 0), -1;
+    msgpack_enc_length(L, B, n, 0x90, MSG_TYPE_ARR16, MSG_TYPE_ARR32);
+  } else {
+    size_t pos = xrio_buffgetidx(B);
+    msgpack_enc_length(L, B, n, 0x90, MSG_TYPE_ARR16, MSG_TYPE_ARR32);
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+      if (!lua_isinteger(L, -2) || lua_tointeger(L, -2) != i + 1) {
+        if (msgpack_enc_seqrest(L, i, n))
+          break;
+        xrio_buffreset(B, pos);
+        if (E->gather)
+          msgpack_gather_truncate(E->gather, pos);
+        return msgpack_stats_add(array_fallbacks, n > 0), -1; /* 并非纯数组 */
+      }
+      msgpack_enc_value(L, E, B, level, "array");
+      lua_pop(L, 1); i++;
+    }
+  }
+  for (i++; i <= n; i++)
+  {
+    lua_rawgeti(L, -1, i);
+    msgpack_enc_value(L, E, B, level, "array");
+    lua_pop(L, 1);
   }
+  return 0;
+}
+
+/* 编码`Map`: 直接写入`root`缓冲区, 结束后回填数量. */
+int msgpack_enc_map(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int level) {
+  if (level > USE_MSGPACK_MAX_DEPTH)
+    return msgpack_stats_error(MSGPACK_STATS_EDEPTH), luaL_error(L, "[msgpack encode]: The maximum user-defined encoding depth was exceeded.");
+  luaL_checkstack(L, 3, "[msgpack encode]: lua stack overflow.");
+  msgpack_stats_max(max_depth, level);
+
+  if (!msgpack_enc_array(L, E, B, level))
+    return 0;
+  if (E->canonical)
+    return msgpack_enc_canonical_map(L, E, B, level);
+
+  int kt; size_t count = 0; size_t pos = xrio_buffgetidx(B);
+  if (B->write) {
+    /* 直接写出时无法回填, 预先计算数量 */
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+      lua_pop(L, 1); count++;
+    }
+    msgpack_enc_length(L, B, count, 0x80, MSG_TYPE_MAP16, MSG_TYPE_MAP32);
+  } else
+    xrio_addchar(B, 0x80); /* 预留头部 */
   lua_pushnil(L);
-  xrio_Buffer B; xrio_buffinit(L, &B);
   while (lua_next(L, -2))
   {
     /* 获取`Key`字段类型 */
@@ -200,79 +383,138 @@ int msgpack_enc_map(lua_State *L, xrio_Buffer *root) {
     {
       case LUA_TSTRING:
         {
-          size_t bsize; const char* buffer = luaL_checklstring(L, -2, &bsize);
-          msgpack_enc_string(L, &B, buffer, bsize);
+          size_t bsize; const char* buffer = lua_tolstring(L, -2, &bsize);
+          if (E->keys && bsize <= MSGPACK_ENCKEY_KEYLEN)
+            msgpack_enc_key(L, E, B, -2, buffer, bsize);
+          else
+            msgpack_enc_string(L, B, buffer, bsize);
         }
         break;
       case LUA_TNUMBER:
         if (lua_isinteger(L, -2))
-          msgpack_enc_integer(&B, lua_tointeger(L, -2));  
+          msgpack_enc_integer(B, lua_tointeger(L, -2));
         else
-          msgpack_enc_number(&B, lua_tonumber(L, -2));
+          msgpack_enc_number(B, lua_tonumber(L, -2));
         break;
       default:
-        B.L = NULL; xrio_pushresult(&B);
-        return luaL_error(L, "[msgpack encode]: Invalid map key type `%s`.", lua_typename(L, kt));
+        return msgpack_stats_error(MSGPACK_STATS_EENCODE), luaL_error(L, "[msgpack encode]: Invalid map key type `%s`.", lua_typename(L, kt));
     }
     /* 获取`Value`字段类型 */
-    vt = lua_type(L, -1);
-    switch (vt)
-    {
-      case LUA_TBOOLEAN:
-        msgpack_enc_boolean(&B, lua_toboolean(L, -1));
-        break;
-      case LUA_TLIGHTUSERDATA:
-        msgpack_enc_nil(&B);
-        break;
-      case LUA_TSTRING:
-        {
-          size_t bsize; const char* buffer = luaL_checklstring(L, -1, &bsize);
-          msgpack_enc_string(L, &B, buffer, bsize);
-        }
-        break;
-      case LUA_TNUMBER:
-        if (lua_isinteger(L, -1))
-          msgpack_enc_integer(&B, lua_tointeger(L, -1));  
-        else
-          msgpack_enc_number(&B, lua_tonumber(L, -1));
-        break;
-      case LUA_TTABLE:
-        msgpack_enc_map(L, &B);
-        break;
-      default:
-        B.L = NULL; xrio_pushresult(&B);
-        return luaL_error(L, "[msgpack encode]: Unsupported map value type `%s`.", lua_typename(L, vt));
-    }
+    msgpack_enc_value(L, E, B, level, "map");
     lua_pop(L, 1);
     count++;
   }
+  if (B->write)
+    return 0;
+  int hlen = msgpack_enc_header(L, B, pos, count);
+  if (E->gather && hlen > 1)
+    msgpack_gather_shift(E->gather, pos, hlen - 1);
+  return 0;
+}
 
-  if (count <= 15)
-    xrio_addchar(root, 0x80 + count);
-  else if(count <= UINT16_MAX)
-    xrio_addchar(root, MSG_TYPE_MAP16);
-  else if(count <= UINT32_MAX)
-    xrio_addchar(root, MSG_TYPE_MAP32);
-  else {
-    B.L = NULL; xrio_pushresult(&B);
-    return luaL_error(L, "[msgpack encode]: Invalid map items `%zu`.", count);
-  }
-
-  if (count && B.bidx)
-    xrio_addlstring(root, B.b, B.bidx);
+typedef struct msgpack_EncCall {
+  xrio_Buffer *B; int canonical;
+} msgpack_EncCall;
 
-  B.L = NULL; xrio_pushresult(&B);
+static int msgpack_encode_call(lua_State *L) {
+  msgpack_EncCall *C = lua_touserdata(L, 1);
+  msgpack_Encoder E;
+  msgpack_encoder_init(L, &E);
+  E.canonical = C->canonical;
+  if (C->B->write)
+    E.keys = NULL; /* 缓存依赖于缓冲区中的位置 */
+  lua_pushvalue(L, 2);
+  msgpack_enc_value(L, &E, C->B, 0, "encode");
   return 0;
 }
 
+/*
+  在保护模式下将`idx`处的值编码到`B`中, 返回`lua_pcall`的结果.
+  编码中途抛出错误时`B`可能已经溢出到堆上, 调用者需要先释放缓冲区再通过`lua_error`重新抛出栈顶的错误信息.
+*/
+int msgpack_encode_pcall(lua_State *L, int idx, xrio_Buffer *B, int canonical) {
+  msgpack_EncCall C = { .B = B, .canonical = canonical };
+  lua_pushcfunction(L, msgpack_encode_call);
+  lua_pushlightuserdata(L, &C);
+  lua_pushvalue(L, idx);
+  return lua_pcall(L, 2, 0, 0);
+}
+
+/*
+  编码: msgpack.encode(value [, { canonical = true, hash = true }])
+    canonical 为`true`时`Map`的`key`按固定顺序排列, 相同内容的表总是得到相同的编码结果;
+    hash      为`true`时计算编码结果的`xxHash64`, 作为第二个返回值.
+*/
 int lmsgpack_encode(lua_State *L) {
-  if (!lua_istable(L, 1))
-    return luaL_error(L, "[msgpack error]: encode need a lua table.");
-  lua_settop(L, 1);
+  luaL_checkany(L, 1);
+  lua_settop(L, 2);
+  int canonical = 0, hash = 0;
+  if (!lua_isnil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "canonical");
+    canonical = lua_toboolean(L, -1); lua_pop(L, 1);
+    lua_getfield(L, 2, "hash");
+    hash = lua_toboolean(L, -1); lua_pop(L, 1);
+  }
+  if (hash)
+    return msgpack_encode_hash(L, 1, canonical);
 
   xrio_Buffer root;
   xrio_buffinit(L, &root);
-  msgpack_enc_map(L, &root);
+  if (msgpack_encode_pcall(L, 1, &root, canonical) != LUA_OK) {
+    root.L = NULL; xrio_pushresult(&root);
+    return lua_error(L);
+  }
+  msgpack_stats_message(1, xrio_buffgetidx((&root)));
   xrio_pushresult(&root);
   return 1;
-}
\ No newline at end of file
+}
+
+typedef struct msgpack_EncWriter {
+  int fd; int err;
+  size_t total;   /* 已写出的字节数 */
+} msgpack_EncWriter;
+
+static void msgpack_encode_write(xrio_Buffer *B, const char *b, size_t len) {
+  msgpack_EncWriter *W = B->ud;
+  while (len > 0 && !W->err)
+  {
+    ssize_t n = write(W->fd, b, len);
+    if (n < 0) {
+      if (errno != EINTR)
+        W->err = errno;  /* 之后的内容都会被丢弃 */
+      continue;
+    }
+    b += n; len -= n; W->total += n;
+  }
+}
+
+/*
+  编码并直接写入文件描述符: msgpack.encode_to(fd_or_file, value)
+  只使用固定大小的缓冲区, 写满后立即写出, 较长的字符串不经过缓冲区; 所以内存占用与输出的大小无关.
+  成功返回写出的字节数, 写入失败返回`nil`与错误信息(文件描述符需要是阻塞的).
+*/
+int lmsgpack_encode_to(lua_State *L) {
+  int fd = msgpack_checkfd(L, 1);
+  luaL_checkany(L, 2);
+  lua_settop(L, 2);
+
+  msgpack_EncWriter W = { .fd = fd, .err = 0, .total = 0 };
+  xrio_Buffer B;
+  xrio_buffinit(L, &B);
+  B.write = msgpack_encode_write; B.ud = &W;
+  int ret = msgpack_encode_pcall(L, 2, &B, 0);
+  if (ret == LUA_OK)
+    xrio_buffflush(&B);
+  B.L = NULL; xrio_pushresult(&B);
+  if (ret != LUA_OK)
+    return lua_error(L);
+  msgpack_stats_message(1, W.total);
+  if (W.err) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(W.err));
+    return 2;
+  }
+  lua_pushinteger(L, W.total);
+  return 1;
+}
@@ -0,0 +1,278 @@
+#include "msgpack.h"
+
+/*
+  扩展类型:
+    1. 标准的`timestamp`(类型`-1`)由`C`直接编解码, 解码为带有`lua_Timestamp`元表的`{ sec = ?, nsec = ? }`;
+    2. 通过`msgpack.register_ext`注册的类型会调用对应的`Lua`函数进行编解码;
+    3. 其它未注册的类型解码为带有`lua_Ext`元表的`{ type = ?, data = ? }`, 编码时原样写回.
+  是否注册了解码函数记录在`C`侧的标记表内, 所以未注册的类型不会产生任何`Lua`函数调用.
+*/
+
+#define MSGPACK_EXT_TIMESTAMP (-1)
+
+/* 获取扩展类型注册表(保存在注册表中) */
+static inline msgpack_ExtRegistry* msgpack_ext_registry(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, "lua_ExtRegistry");
+  msgpack_ExtRegistry *R = lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return R;
+}
+
+/* 写入扩展类型的头部 */
+static inline void msgpack_enc_exthead(lua_State *L, xrio_Buffer *B, int8_t type, size_t bsize) {
+  switch (bsize)
+  {
+    case 1: xrio_addchar(B, MSG_TYPE_FIXEXT1); break;
+    case 2: xrio_addchar(B, MSG_TYPE_FIXEXT2); break;
+    case 4: xrio_addchar(B, MSG_TYPE_FIXEXT4); break;
+    case 8: xrio_addchar(B, MSG_TYPE_FIXEXT8); break;
+    case 16: xrio_addchar(B, MSG_TYPE_FIXEXT16); break;
+    default:
+      if (bsize <= UINT8_MAX) {
+        xrio_addchar(B, MSG_TYPE_EXT8);
+        xrio_addchar(B, (uint8_t)bsize);
+      } else if (bsize <= UINT16_MAX) {
+        uint16_t data = bsize; xrio_hton16(&data);
+        xrio_addchar(B, MSG_TYPE_EXT16);
+        xrio_addlstring(B, (char*)&data, 2);
+      } else if (bsize <= UINT32_MAX) {
+        uint32_t data = bsize; xrio_hton32(&data);
+        xrio_addchar(B, MSG_TYPE_EXT32);
+        xrio_addlstring(B, (char*)&data, 4);
+      } else
+        luaL_error(L, "[msgpack encode]: ext data was too long(%zu).", bsize);
+  }
+  xrio_addchar(B, (char)type);
+}
+
+/* 编码`timestamp`: 根据取值范围选择`32`/`64`/`96`位格式. */
+static void msgpack_enc_timestamp(lua_State *L, xrio_Buffer *B, lua_Integer sec, lua_Integer nsec) {
+  if (nsec < 0 || nsec > 999999999)
+    luaL_error(L, "[msgpack encode]: Invalid timestamp nsec `%I`.", (lua_Integer)nsec);
+  if (sec >= 0 && (sec >> 34) == 0) {
+    if (nsec == 0 && (sec >> 32) == 0) {
+      uint32_t data = sec; xrio_hton32(&data);
+      msgpack_enc_exthead(L, B, MSGPACK_EXT_TIMESTAMP, 4);
+      xrio_addlstring(B, (char*)&data, 4);
+      return;
+    }
+    uint64_t data = ((uint64_t)nsec << 34) | (uint64_t)sec; xrio_hton64(&data);
+    msgpack_enc_exthead(L, B, MSGPACK_EXT_TIMESTAMP, 8);
+    xrio_addlstring(B, (char*)&data, 8);
+    return;
+  }
+  uint32_t ns = nsec; xrio_hton32(&ns);
+  uint64_t s = sec; xrio_hton64(&s);
+  msgpack_enc_exthead(L, B, MSGPACK_EXT_TIMESTAMP, 12);
+  xrio_addlstring(B, (char*)&ns, 4);
+  xrio_addlstring(B, (char*)&s, 8);
+}
+
+/* 读取表中的整数字段 */
+static inline lua_Integer msgpack_ext_field(lua_State *L, int idx, const char *field) {
+  lua_getfield(L, idx, field);
+  int isnum; lua_Integer v = lua_tointegerx(L, -1, &isnum);
+  if (!isnum && !lua_isnil(L, -1))
+    luaL_error(L, "[msgpack encode]: ext field `%s` must be an integer.", field);
+  lua_pop(L, 1);
+  return v;
+}
+
+/*
+  编码带有元表的值(栈顶为元表, 其下为值), 返回`0`表示不是扩展类型.
+*/
+int msgpack_enc_ext(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B) {
+  const void *mt = lua_topointer(L, -1);
+  if (mt == E->exts->list)
+    return 0;
+  if (mt == E->exts->typed) {
+    msgpack_enc_typed(L, B, -2);
+    return 1;
+  }
+  if (mt == E->exts->vector) {
+    msgpack_enc_vector(L, B, -2, E->canonical);
+    return 1;
+  }
+  luaL_checkstack(L, 4, "[msgpack encode]: lua stack overflow.");
+  if (mt == E->exts->timestamp) {
+    msgpack_enc_timestamp(L, B, msgpack_ext_field(L, -2, "sec"), msgpack_ext_field(L, -2, "nsec"));
+    return 1;
+  }
+  if (mt == E->exts->ext) {
+    lua_Integer type = msgpack_ext_field(L, -2, "type");
+    if (type < INT8_MIN || type > INT8_MAX)
+      return luaL_error(L, "[msgpack encode]: Invalid ext type `%I`.", (lua_Integer)type);
+    lua_getfield(L, -2, "data");
+    size_t bsize; const char *buffer = lua_tolstring(L, -1, &bsize);
+    if (!buffer)
+      return luaL_error(L, "[msgpack encode]: ext data must be a string.");
+    msgpack_enc_exthead(L, B, (int8_t)type, bsize);
+    xrio_addlstring(B, buffer, bsize);
+    lua_pop(L, 1);
+    return 1;
+  }
+  /* 已注册的类型: 元表 -> { type, encode_fn } */
+  lua_pushvalue(L, -1);
+  if (lua_rawget(L, E->extmeta) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  lua_rawgeti(L, -1, 1);
+  int8_t type = (int8_t)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  lua_rawgeti(L, -1, 2);
+  lua_pushvalue(L, -4);
+  lua_call(L, 1, 1);
+  size_t bsize; const char *buffer = lua_tolstring(L, -1, &bsize);
+  if (!buffer)
+    return luaL_error(L, "[msgpack encode]: ext encoder must return a string.");
+  msgpack_enc_exthead(L, B, type, bsize);
+  xrio_addlstring(B, buffer, bsize);
+  lua_pop(L, 2);
+  return 1;
+}
+
+/* 解码`timestamp`, 格式错误时返回`0`. */
+static inline int msgpack_dec_timestamp(lua_State *L, const char *buffer, size_t bsize) {
+  lua_Integer sec, nsec;
+  if (bsize == 4) {
+    uint32_t data; memcpy(&data, buffer, 4); xrio_ntoh32(&data);
+    sec = data; nsec = 0;
+  } else if (bsize == 8) {
+    uint64_t data; memcpy(&data, buffer, 8); xrio_ntoh64(&data);
+    sec = data & 0x00000003ffffffffull; nsec = data >> 34;
+  } else if (bsize == 12) {
+    uint32_t ns; memcpy(&ns, buffer, 4); xrio_ntoh32(&ns);
+    uint64_t s; memcpy(&s, buffer + 4, 8); xrio_ntoh64(&s);
+    sec = (int64_t)s; nsec = ns;
+  } else
+    return 0;
+  lua_createtable(L, 0, 2);
+  lua_pushinteger(L, sec);
+  lua_setfield(L, -2, "sec");
+  lua_pushinteger(L, nsec);
+  lua_setfield(L, -2, "nsec");
+  luaL_setmetatable(L, "lua_Timestamp");
+  return 1;
+}
+
+/* 解码扩展类型(`buffer`指向首字节), 返回消耗的字节数. */
+int msgpack_dec_ext(lua_State *L, msgpack_Decoder *D, const char *buffer, size_t bsize) {
+  msgpack_Head H;
+  if (msgpack_scan_head(buffer, bsize, &H) != MSGPACK_SCAN_DONE || bsize - H.hlen < H.payload)
+    return msgpack_stats_error(MSGPACK_STATS_ETRUNCATED), luaL_error(L, "[msgpack decode]: Insufficient remaining byte array for ext.");
+  int8_t type = buffer[H.hlen - 1];
+  const char *data = buffer + H.hlen; size_t len = H.payload;
+  if (D->max_string || D->max_memory)
+    msgpack_dec_strlimit(L, D, len);
+
+  if (!D->exts)
+    D->exts = msgpack_ext_registry(L);
+  if (D->exts->decoders[(uint8_t)(type + 128)]) {
+    lua_getfield(L, LUA_REGISTRYINDEX, "lua_ExtRegistry");
+    lua_getuservalue(L, -1);
+    lua_rawgeti(L, -1, type);
+    lua_pushlstring(L, data, len);
+    lua_pushinteger(L, type);
+    lua_call(L, 2, 1);
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+    return H.hlen + len;
+  }
+  if (type == MSGPACK_EXT_TIMESTAMP && msgpack_dec_timestamp(L, data, len))
+    return H.hlen + len;
+
+  lua_createtable(L, 0, 2);
+  lua_pushinteger(L, type);
+  lua_setfield(L, -2, "type");
+  lua_pushlstring(L, data, len);
+  lua_setfield(L, -2, "data");
+  luaL_setmetatable(L, "lua_Ext");
+  return H.hlen + len;
+}
+
+/* 注册扩展类型: msgpack.register_ext(type, encode_fn, decode_fn [, metatable]) */
+int lmsgpack_register_ext(lua_State *L) {
+  lua_Integer type = luaL_checkinteger(L, 1);
+  luaL_argcheck(L, type >= INT8_MIN && type <= INT8_MAX, 1, "ext type must be in [-128, 127]");
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    luaL_checktype(L, 4, LUA_TTABLE);
+  }
+  if (!lua_isnoneornil(L, 3))
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+  lua_settop(L, 4);
+
+  /* 解码函数 */
+  msgpack_ExtRegistry *R = msgpack_ext_registry(L);
+  lua_getfield(L, LUA_REGISTRYINDEX, "lua_ExtRegistry");
+  lua_getuservalue(L, -1);
+  lua_pushvalue(L, 3);
+  lua_rawseti(L, -2, type);
+  R->decoders[(uint8_t)(type + 128)] = !lua_isnil(L, 3);
+  lua_pop(L, 2);
+
+  /* 编码函数: 以元表为索引 */
+  if (!lua_isnil(L, 4)) {
+    lua_getfield(L, LUA_REGISTRYINDEX, "lua_ExtMeta");
+    lua_pushvalue(L, 4);
+    if (lua_isnil(L, 2)) {
+      lua_pushnil(L);
+    } else {
+      lua_createtable(L, 2, 0);
+      lua_pushinteger(L, type);
+      lua_rawseti(L, -2, 1);
+      lua_pushvalue(L, 2);
+      lua_rawseti(L, -2, 2);
+    }
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
+/* 创建`timestamp`: msgpack.timestamp(sec [, nsec]) */
+int lmsgpack_timestamp(lua_State *L) {
+  lua_Integer sec = luaL_checkinteger(L, 1);
+  lua_Integer nsec = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, nsec >= 0 && nsec <= 999999999, 2, "nsec must be in [0, 999999999]");
+  lua_createtable(L, 0, 2);
+  lua_pushinteger(L, sec);
+  lua_setfield(L, -2, "sec");
+  lua_pushinteger(L, nsec);
+  lua_setfield(L, -2, "nsec");
+  luaL_setmetatable(L, "lua_Timestamp");
+  return 1;
+}
+
+/* 创建未注册的扩展类型: msgpack.ext(type, data) */
+int lmsgpack_ext(lua_State *L) {
+  lua_Integer type = luaL_checkinteger(L, 1);
+  luaL_argcheck(L, type >= INT8_MIN && type <= INT8_MAX, 1, "ext type must be in [-128, 127]");
+  luaL_checkstring(L, 2);
+  lua_createtable(L, 0, 2);
+  lua_pushinteger(L, type);
+  lua_setfield(L, -2, "type");
+  lua_pushvalue(L, 2);
+  lua_setfield(L, -2, "data");
+  luaL_setmetatable(L, "lua_Ext");
+  return 1;
+}
+
+void msgpack_ext_meta(lua_State *L) {
+  msgpack_ExtRegistry *R = lua_newuserdata(L, sizeof(msgpack_ExtRegistry));
+  memset(R, 0, sizeof(msgpack_ExtRegistry));
+  luaL_newmetatable(L, "lua_Timestamp");
+  R->timestamp = lua_topointer(L, -1);
+  luaL_newmetatable(L, "lua_Ext");
+  R->ext = lua_topointer(L, -1);
+  luaL_getmetatable(L, "lua_List");
+  R->list = lua_topointer(L, -1);
+  lua_pop(L, 3);
+  lua_newtable(L);
+  lua_setuservalue(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, "lua_ExtRegistry");
+
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, "lua_ExtMeta");
+}
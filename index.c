@@ -0,0 +1,319 @@
+#include "msgpack.h"
+
+/*
+  结构索引: 一次遍历记录每个容器的位置与每个子元素的起始位置, 之后按路径查找时不再需要扫描字节.
+  `Array`的第`n`个元素可以直接定位; 较大的`Map`额外建立`key`的哈希表, 较小的`Map`按顺序比较`key`.
+  容器的子元素在`slots`中连续存放(`Map`为`key`、`value`交替), 子元素的结束位置即下一个子元素的起始位置.
+*/
+#define MSGPACK_INDEX_NONE  (SIZE_MAX)    /* 标量没有对应的容器节点 */
+#define MSGPACK_INDEX_HASHMIN  (8)        /* 键值对数量达到该值的`Map`才建立哈希表 */
+
+typedef struct msgpack_IndexSlot {
+  size_t offset;      /* 子元素的起始位置 */
+  size_t node;        /* 子元素为容器时对应的节点, 否则为`MSGPACK_INDEX_NONE` */
+} msgpack_IndexSlot;
+
+typedef struct msgpack_IndexNode {
+  size_t end;         /* 容器的结束位置 */
+  size_t slots;       /* 第一个子元素在`slots`中的下标 */
+  uint64_t count;     /* 元素数量(`Map`为键值对数量) */
+  size_t hash;        /* 哈希表在`hash`中的起始下标 */
+  uint32_t hmask;     /* 哈希表大小减`1`, 为`0`时没有哈希表 */
+  uint8_t kind;
+} msgpack_IndexNode;
+
+typedef struct msgpack_Index {
+  const char *data;   /* 原始字符串(锚定在`uservalue`中) */
+  msgpack_IndexSlot root;
+  size_t size;        /* 顶层值的编码长度 */
+  int depth;          /* 非空容器的最大嵌套层数, 更长的路径不可能匹配 */
+  msgpack_IndexNode *nodes; size_t nnodes; size_t cnodes;
+  msgpack_IndexSlot *slots; size_t nslots; size_t cslots;
+  uint32_t *hash; size_t nhash; size_t chash;   /* 开放寻址, 保存键值对的序号加`1`, `0`为空 */
+} msgpack_Index;
+
+#define msgpack_index_check(L) ((msgpack_Index*)luaL_checkudata(L, 1, "lua_Index"))
+
+/* 按需扩展数组, 失败时抛出异常(已分配的内存由`__gc`释放) */
+static void* msgpack_index_grow(lua_State *L, void *ptr, size_t *cap, size_t need, size_t esize) {
+  if (need <= *cap)
+    return ptr;
+  size_t ncap = *cap ? *cap : 64;
+  while (ncap < need)
+    ncap <<= 1;
+  void *nptr = xrio_realloc(ptr, ncap * esize);
+  if (!nptr)
+    luaL_error(L, "[msgpack error]: index out of memory.");
+  *cap = ncap;
+  return nptr;
+}
+
+/* `Map`的子元素全部记录后建立哈希表, 重复的`key`保持与顺序比较相同的结果(先出现的优先). */
+static void msgpack_index_hashmap(lua_State *L, msgpack_Index *I, msgpack_IndexNode *node, const char *buffer) {
+  if (node->count < MSGPACK_INDEX_HASHMIN || node->count > UINT32_MAX / 4)
+    return;
+  size_t size = MSGPACK_INDEX_HASHMIN * 2;
+  while (size < node->count * 2)
+    size <<= 1;
+  I->hash = msgpack_index_grow(L, I->hash, &I->chash, I->nhash + size, sizeof(uint32_t));
+  uint32_t *hash = &I->hash[I->nhash];
+  memset(hash, 0, size * sizeof(uint32_t));
+  const msgpack_IndexSlot *slots = &I->slots[node->slots];
+  for (uint32_t k = 0; k < node->count; k++)
+  {
+    uint64_t h;
+    if (!msgpack_path_keyhash(buffer + slots[k * 2].offset, slots[k * 2 + 1].offset - slots[k * 2].offset, &h))
+      continue;
+    size_t i = h & (size - 1);
+    while (hash[i])
+      i = (i + 1) & (size - 1);
+    hash[i] = k + 1;
+  }
+  node->hash = I->nhash; node->hmask = size - 1;
+  I->nhash += size;
+}
+
+typedef struct msgpack_IndexFrame {
+  size_t node; uint64_t next; uint64_t total;
+} msgpack_IndexFrame;
+
+/*
+  构建索引: 与`msgpack_validate`相同的迭代遍历, 只是额外记录了每个子元素的位置.
+  嵌套超出栈上数组时改为保存在栈顶的`userdata`中, 出错时由`GC`回收.
+*/
+static void msgpack_index_build(lua_State *L, msgpack_Index *I, const char *buffer, size_t bsize, int max_depth) {
+  msgpack_IndexFrame fixed[USE_MSGPACK_MAX_STACK];
+  msgpack_IndexFrame *stack = fixed; int cap = USE_MSGPACK_MAX_STACK;
+  msgpack_Head H; size_t pos = 0; int depth = 0; int top = lua_gettop(L);
+  if (max_depth <= 0)
+    max_depth = USE_MSGPACK_MAX_STACK - 1;
+  for (;;)
+  {
+    int ret = msgpack_scan_head(buffer + pos, bsize - pos, &H);
+    if (ret != MSGPACK_SCAN_DONE)
+      luaL_error(L, "%s", msgpack_scan_strerror(ret));
+    if (bsize - pos - H.hlen < H.payload)
+      luaL_error(L, "%s", msgpack_scan_strerror(MSGPACK_SCAN_AGAIN));
+
+    msgpack_IndexSlot *slot = depth > 0 ? &I->slots[I->nodes[stack[depth - 1].node].slots + stack[depth - 1].next] : &I->root;
+    slot->offset = pos; slot->node = MSGPACK_INDEX_NONE;
+    pos += H.hlen + H.payload;
+
+    if (H.kind != MSGPACK_KIND_SCALAR) {
+      if (depth + 1 > max_depth)
+        luaL_error(L, "%s", msgpack_scan_strerror(MSGPACK_SCAN_EDEPTH));
+      uint64_t total = H.kind == MSGPACK_KIND_MAP ? H.count * 2 : H.count;
+      /* 每个元素至少占用`1`字节, 不合理的数量不会导致预先分配大量内存. */
+      if (total > bsize - pos)
+        luaL_error(L, "%s", msgpack_scan_strerror(MSGPACK_SCAN_AGAIN));
+      I->nodes = msgpack_index_grow(L, I->nodes, &I->cnodes, I->nnodes + 1, sizeof(msgpack_IndexNode));
+      I->slots = msgpack_index_grow(L, I->slots, &I->cslots, I->nslots + total, sizeof(msgpack_IndexSlot));
+      /* `slots`可能被重新分配, 重新获取当前元素的位置 */
+      slot = depth > 0 ? &I->slots[I->nodes[stack[depth - 1].node].slots + stack[depth - 1].next] : &I->root;
+      slot->node = I->nnodes;
+      msgpack_IndexNode *node = &I->nodes[I->nnodes];
+      node->end = pos; node->slots = I->nslots; node->count = H.count; node->kind = H.kind;
+      node->hash = 0; node->hmask = 0;
+      I->nslots += total;
+      if (total) {
+        if (depth == cap) {
+          msgpack_IndexFrame *nstack = lua_newuserdata(L, sizeof(msgpack_IndexFrame) * cap * 2);
+          memcpy(nstack, stack, sizeof(msgpack_IndexFrame) * cap);
+          if (stack != fixed)
+            lua_remove(L, -2);
+          stack = nstack; cap *= 2;
+        }
+        stack[depth].node = I->nnodes++; stack[depth].next = 0; stack[depth].total = total;
+        if (++depth > I->depth)
+          I->depth = depth;
+        continue;
+      }
+      I->nnodes++;
+    }
+
+    /* 一个值已完整: 逐层出栈并记录容器的结束位置 */
+    while (depth > 0 && ++stack[depth - 1].next == stack[depth - 1].total)
+    {
+      msgpack_IndexNode *node = &I->nodes[stack[depth - 1].node];
+      node->end = pos;
+      if (node->kind == MSGPACK_KIND_MAP)
+        msgpack_index_hashmap(L, I, node, buffer);
+      depth--;
+    }
+    if (depth == 0) {
+      I->size = pos;
+      lua_settop(L, top);
+      return;
+    }
+  }
+}
+
+/* 按路径查找, 找到时通过`slot`返回目标元素, 并通过`end`返回其结束位置. */
+static int msgpack_index_find(msgpack_Index *I, const msgpack_PathSeg *segs, int count, msgpack_IndexSlot *slot, size_t *end) {
+  *slot = I->root; *end = I->root.offset + I->size;
+  for (int i = 0; i < count; i++)
+  {
+    if (slot->node == MSGPACK_INDEX_NONE)
+      return 0;
+    const msgpack_IndexNode *node = &I->nodes[slot->node];
+    const msgpack_IndexSlot *slots = &I->slots[node->slots];
+    size_t total = node->kind == MSGPACK_KIND_MAP ? node->count * 2 : node->count;
+    size_t n;
+    if (node->kind == MSGPACK_KIND_ARRAY) {
+      if (segs[i].type != LUA_TNUMBER || segs[i].idx < 1 || (uint64_t)segs[i].idx > node->count)
+        return 0;
+      n = segs[i].idx - 1;
+    } else if (node->hmask) {
+      const uint32_t *hash = &I->hash[node->hash];
+      size_t h = msgpack_path_seghash(&segs[i]) & node->hmask;
+      for (;; h = (h + 1) & node->hmask)
+      {
+        if (!hash[h])
+          return 0;
+        n = (size_t)(hash[h] - 1) * 2 + 1;
+        if (msgpack_path_keyeq(I->data + slots[n - 1].offset, slots[n].offset - slots[n - 1].offset, &segs[i]))
+          break;
+      }
+    } else {
+      for (n = 1; n < total; n += 2)
+        if (msgpack_path_keyeq(I->data + slots[n - 1].offset, slots[n].offset - slots[n - 1].offset, &segs[i]))
+          break;
+      if (n >= total)
+        return 0;
+    }
+    *end = n + 1 < total ? slots[n + 1].offset : node->end;
+    *slot = slots[n];
+  }
+  return 1;
+}
+
+/* 获取路径参数: 可以是多个`key`, 也可以是预编译的`lua_Path` */
+static int msgpack_index_path(lua_State *L, msgpack_Index *I, msgpack_IndexSlot *slot, size_t *end) {
+  msgpack_Path *P = luaL_testudata(L, 2, "lua_Path");
+  if (P)
+    return msgpack_index_find(I, P->segs, P->count, slot, end);
+  /* 比索引的最大嵌套更深的路径不可能匹配, 所以`segs`的大小也受到文档本身的限制 */
+  int count = lua_gettop(L) - 1;
+  if (count > I->depth)
+    return 0;
+  msgpack_PathSeg fixed[USE_MSGPACK_MAX_STACK], *segs = fixed;
+  if (count > USE_MSGPACK_MAX_STACK)
+    segs = lua_newuserdata(L, sizeof(msgpack_PathSeg) * count);
+  for (int i = 0; i < count; i++)
+    msgpack_path_seg(L, i + 2, &segs[i]);
+  return msgpack_index_find(I, segs, count, slot, end);
+}
+
+static int msgpack_index_get_init(lua_State *L) {
+  msgpack_Index *I = lua_touserdata(L, 1);
+  msgpack_IndexSlot slot; size_t end;
+  if (!msgpack_index_path(L, I, &slot, &end))
+    return 0;
+  msgpack_Decoder D = { .keys = NULL };
+  msgpack_dec_value(L, &D, 1, I->data + slot.offset, end - slot.offset);
+  return 1;
+}
+
+/* 解码路径对应的值: index:get("a", 3), 未找到时返回`nil`, 格式错误时返回`false`与错误信息. */
+static int msgpack_index_get(lua_State *L) {
+  msgpack_Index *I = msgpack_index_check(L);
+  if (!I->data)
+    return 0;
+  int top = lua_gettop(L);
+  lua_pushcfunction(L, msgpack_index_get_init);
+  lua_insert(L, 1);
+  if (LUA_OK == lua_pcall(L, top, 1, 0))
+    return 1;
+  lua_pushboolean(L, 0);
+  lua_insert(L, -2);
+  return 2;
+}
+
+/* 路径对应的值的原始编码: index:raw("a", 3), 未找到时返回`nil`. */
+static int msgpack_index_raw(lua_State *L) {
+  msgpack_Index *I = msgpack_index_check(L);
+  msgpack_IndexSlot slot; size_t end;
+  if (!I->data || !msgpack_index_path(L, I, &slot, &end))
+    return 0;
+  lua_pushlstring(L, I->data + slot.offset, end - slot.offset);
+  return 1;
+}
+
+/* 路径对应的容器的元素数量: index:len("a"), 不是容器或未找到时返回`nil`. */
+static int msgpack_index_len(lua_State *L) {
+  msgpack_Index *I = msgpack_index_check(L);
+  msgpack_IndexSlot slot; size_t end;
+  if (!I->data || !msgpack_index_path(L, I, &slot, &end) || slot.node == MSGPACK_INDEX_NONE)
+    return 0;
+  lua_pushinteger(L, I->nodes[slot.node].count);
+  return 1;
+}
+
+static int msgpack_index_gc(lua_State *L) {
+  msgpack_Index *I = msgpack_index_check(L);
+  if (I->nodes)
+    xrio_free(I->nodes);
+  if (I->slots)
+    xrio_free(I->slots);
+  if (I->hash)
+    xrio_free(I->hash);
+  I->nodes = NULL; I->slots = NULL; I->hash = NULL; I->data = NULL;
+  I->nnodes = I->cnodes = I->nslots = I->cslots = I->nhash = I->chash = 0;
+  return 0;
+}
+
+static int msgpack_index_init(lua_State *L) {
+  size_t bsize;
+  const char *buffer = luaL_checklstring(L, 1, &bsize);
+  if (!buffer || bsize < 1)
+    return luaL_error(L, "[msgpack error]: decode buffer was empty");
+  size_t offset = msgpack_decode_pos(L, 2, bsize);
+  msgpack_Index *I = lua_newuserdata(L, sizeof(msgpack_Index));
+  memset(I, 0, sizeof(msgpack_Index));
+  luaL_setmetatable(L, "lua_Index");
+  lua_pushvalue(L, 1);
+  lua_setuservalue(L, -2);
+  msgpack_index_build(L, I, buffer + offset, bsize - offset, msgpack_decode_maxdepth(L, 3));
+  I->data = buffer + offset;
+  /* 节点、子元素与哈希表的数量已确定, 释放多余的空间(失败时保留原来的内存) */
+  void *ptr;
+  if (I->cnodes > I->nnodes && I->nnodes && (ptr = xrio_realloc(I->nodes, I->nnodes * sizeof(msgpack_IndexNode)))) {
+    I->nodes = ptr; I->cnodes = I->nnodes;
+  }
+  if (I->cslots > I->nslots && I->nslots && (ptr = xrio_realloc(I->slots, I->nslots * sizeof(msgpack_IndexSlot)))) {
+    I->slots = ptr; I->cslots = I->nslots;
+  }
+  if (I->chash > I->nhash && I->nhash && (ptr = xrio_realloc(I->hash, I->nhash * sizeof(uint32_t)))) {
+    I->hash = ptr; I->chash = I->nhash;
+  }
+  lua_pushinteger(L, offset + I->size + 1);
+  return 2;
+}
+
+/* 构建索引: msgpack.index(buffer [, pos [, { max_depth = ? }]]), 同时返回下一个值的起始位置; 格式错误时返回`false`与错误信息. */
+int lmsgpack_index(lua_State *L) {
+  luaL_checkstring(L, 1);
+  lua_settop(L, 3);
+  lua_pushcfunction(L, msgpack_index_init);
+  lua_insert(L, 1);
+  if (LUA_OK == lua_pcall(L, 3, 2, 0))
+    return 2;
+  lua_pushboolean(L, 0);
+  lua_insert(L, -2);
+  return 2;
+}
+
+void msgpack_index_meta(lua_State *L) {
+  luaL_Reg index_libs[] = {
+    {"get", msgpack_index_get},
+    {"raw", msgpack_index_raw},
+    {"len", msgpack_index_len},
+    {NULL, NULL}
+  };
+  luaL_newmetatable(L, "lua_Index");
+  luaL_newlib(L, index_libs);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, msgpack_index_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
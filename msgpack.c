@@ -7,12 +7,42 @@ LUAMOD_API int luaopen_lmsgpack(lua_State *L) {
   /* 元表 */
   luaL_newmetatable(L, "lua_Table");
   luaL_newmetatable(L, "lua_List");
+  msgpack_unpacker_meta(L);
+  msgpack_packer_meta(L);
+  msgpack_reader_meta(L);
+  msgpack_enckey_meta(L);
+  msgpack_schema_meta(L);
+  msgpack_view_meta(L);
+  msgpack_path_meta(L);
+  msgpack_index_meta(L);
+  msgpack_ext_meta(L);
+  msgpack_typed_meta(L);
 
   luaL_Reg msgpack_libs[] = {
     {"encode", lmsgpack_encode},
+    {"encode_to", lmsgpack_encode_to},
     {"decode", lmsgpack_decode},
+    {"decode_all", lmsgpack_decode_all},
+    {"validate", lmsgpack_validate},
+    {"sizeof", lmsgpack_sizeof},
     {"pack", lmsgpack_encode},
     {"unpack", lmsgpack_decode},
+    {"unpacker", lmsgpack_unpacker},
+    {"packer", lmsgpack_packer},
+    {"open", lmsgpack_open},
+    {"parallel_scan", lmsgpack_parallel_scan},
+    {"clear_key_cache", lmsgpack_clear_key_cache},
+    {"schema", lmsgpack_schema},
+    {"view", lmsgpack_view},
+    {"get", lmsgpack_get},
+    {"path", lmsgpack_path},
+    {"index", lmsgpack_index},
+    {"timestamp", lmsgpack_timestamp},
+    {"ext", lmsgpack_ext},
+    {"register_ext", lmsgpack_register_ext},
+    {"vector", lmsgpack_vector},
+    {"stats", lmsgpack_stats},
+    {"stats_reset", lmsgpack_stats_reset},
     {NULL, NULL}
   };
   luaL_newlib(L, msgpack_libs);
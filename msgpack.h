@@ -5,20 +5,42 @@
 
 #define LUA_LIB
 
-#include <core.h>
+#if defined(USE_MSGPACK_STANDALONE)
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <string.h>
+  #include <stdint.h>
+  #include <math.h>
+  #include <lua.h>
+  #include <lauxlib.h>
+  #include <lualib.h>
+#else
+  #include <core.h>
+#endif
 #include <stdbool.h>
 
 /*
-  以下`3`个宏可以改变一些默认行为:
+  USE_MSGPACK_STANDALONE : 不依赖宿主框架的`core.h`, 直接使用标准的`Lua 5.3/5.4`头文件构建.
+  USE_MSGPACK_BENCH      : 由性能测试程序定义, 将所有内存分配转发到它的计数器.
+  USE_MSGPACK_NO_STATS   : 移除运行时统计(`msgpack.stats`), 热路径上不再有任何计数.
+*/
+
+/*
+  以下`4`个宏可以改变一些默认行为:
     USE_MSGPACK_STR24     : 默认不会解析超出`24`位大小的字符串, 定义了此宏则会解析.
     USE_MSGPACK_KEY32     : 默认不会解析`32`位大小的字符串`key`, 定义了此宏则会解析.
-    USE_MSGPACK_MAX_STACK : 自定义最大栈大小与最大递归解析深度, 超出则会自动结束解析.
+    USE_MSGPACK_MAX_STACK : 自定义默认的最大解析深度(`decode`可以通过`max_depth`选项单独指定), 超出则会自动结束解析.
+    USE_MSGPACK_MAX_DEPTH : 自定义最大递归编码深度(防止循环引用), 超出则会自动结束编码.
 */
 
 #if !defined(USE_MSGPACK_MAX_STACK)
   #define USE_MSGPACK_MAX_STACK LUA_MINSTACK
 #endif
 
+#if !defined(USE_MSGPACK_MAX_DEPTH)
+  #define USE_MSGPACK_MAX_DEPTH 1000
+#endif
+
 #define MSG_TYPE_NIL          0xc0
 #define MSG_TYPE_FALSE        0xc2
 #define MSG_TYPE_TRUE         0xc3
@@ -60,6 +82,13 @@
 #define MSG_TYPE_MAP16        0xde
 #define MSG_TYPE_MAP32        0xdf
 
+#if defined(USE_MSGPACK_BENCH)
+  void* msgpack_bench_realloc(void *ptr, size_t size);
+  #define xrio_malloc(size)       msgpack_bench_realloc(NULL, (size))
+  #define xrio_realloc(ptr, size) msgpack_bench_realloc((ptr), (size))
+  #define xrio_free(ptr)          msgpack_bench_realloc((ptr), 0)
+#endif
+
 #ifndef xrio_malloc
   #define xrio_malloc malloc
 #endif
@@ -72,6 +101,49 @@
   #define xrio_free free
 #endif
 
+/*
+  运行时统计: 进程内累计的计数器, 只有简单的加法, 所以默认启用.
+  计数器使用`relaxed`的原子操作, 多个`lua_State`在不同线程中同时使用时也不会丢失计数.
+*/
+#define MSGPACK_STATS_ETRUNCATED  (0)   /* 数据不完整 */
+#define MSGPACK_STATS_EFORMAT     (1)   /* 不支持的类型、`key`、浮点数或字符串长度 */
+#define MSGPACK_STATS_EDEPTH      (2)   /* 超出编码或解码的嵌套深度 */
+#define MSGPACK_STATS_ELIMIT      (3)   /* 超出解码的资源限制 */
+#define MSGPACK_STATS_EENCODE     (4)   /* 无法编码的值 */
+#define MSGPACK_STATS_ERRORS      (5)
+
+#define MSGPACK_STATS_BUCKETS     (12)  /* 消息大小: 第`i`个区间的上限为`64 << 2i`字节, 最后一个区间没有上限 */
+
+typedef struct msgpack_Stats {
+  uint64_t encode_calls; uint64_t bytes_out;
+  uint64_t decode_calls; uint64_t bytes_in;
+  uint64_t errors[MSGPACK_STATS_ERRORS];
+  uint64_t tables;            /* 解码时创建的表 */
+  uint64_t max_depth;         /* 编码或解码达到的最大嵌套深度 */
+  uint64_t spills;            /* 缓冲区超出`xrio_buffer_size`而改用堆内存的次数 */
+  uint64_t realloc_bytes;     /* 缓冲区在堆上分配的总字节数 */
+  uint64_t array_fallbacks;   /* 长度不为`0`但不是纯数组而退回`Map`的次数 */
+  uint64_t sizes[MSGPACK_STATS_BUCKETS];
+} msgpack_Stats;
+
+#if !defined(USE_MSGPACK_NO_STATS)
+  extern msgpack_Stats msgpack_stats;
+  void msgpack_stats_message(int encode, size_t size);
+  /* 只有超过当前最大值时才需要比较并交换 */
+  static inline void msgpack_stats_maxof(uint64_t *field, uint64_t n) {
+    uint64_t v = __atomic_load_n(field, __ATOMIC_RELAXED);
+    while (v < n && !__atomic_compare_exchange_n(field, &v, n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  }
+  #define msgpack_stats_add(field, n)   ((void)__atomic_fetch_add(&msgpack_stats.field, (uint64_t)(n), __ATOMIC_RELAXED))
+  #define msgpack_stats_max(field, n)   msgpack_stats_maxof(&msgpack_stats.field, (uint64_t)(n))
+  #define msgpack_stats_error(kind)     ((void)__atomic_fetch_add(&msgpack_stats.errors[kind], 1, __ATOMIC_RELAXED))
+#else
+  #define msgpack_stats_message(encode, size)  ((void)(encode), (void)(size))
+  #define msgpack_stats_add(field, n)   ((void)0)
+  #define msgpack_stats_max(field, n)   ((void)0)
+  #define msgpack_stats_error(kind)     ((void)0)
+#endif
+
 /* 64bit */
 typedef union xrio_u64 {
   int64_t   i;
@@ -92,6 +164,9 @@ typedef union xrio_u32 {
 typedef struct xrio_Buffer {
   char* b; lua_State *L;
   size_t bidx; size_t blen;
+  /* 不为`NULL`时缓冲区写满后直接写出(而不是扩展), 过长的内容不经过缓冲区. */
+  void (*write)(struct xrio_Buffer *B, const char *b, size_t l);
+  void *ud;
   char ptr[xrio_buffer_size];
 } xrio_Buffer;
 
@@ -106,25 +181,303 @@ typedef struct xrio_Buffer {
 void  xrio_buffinit(lua_State *L, xrio_Buffer *B);
 void* xrio_buffinitsize(lua_State *L, xrio_Buffer *B, size_t rsize);
 void  xrio_pushresult(xrio_Buffer *B);
+void  xrio_buffflush(xrio_Buffer *B);
 
 void  xrio_addchar(xrio_Buffer *B, char c);
 void  xrio_addstring(xrio_Buffer *B, const char *b);
 void  xrio_addlstring(xrio_Buffer *B, const char *b, size_t l);
+void  xrio_insertspace(xrio_Buffer *B, size_t idx, size_t l);
+char* xrio_reserve(xrio_Buffer *B, size_t l);
+
+/* 可断点续扫的消息边界扫描器 */
+#define MSGPACK_SCAN_DONE     ( 1)    /* 已扫描出一个完整的值, 长度为`pos` */
+#define MSGPACK_SCAN_AGAIN    ( 0)    /* 数据不足, 补充数据后可继续扫描 */
+#define MSGPACK_SCAN_EBYTE    (-1)    /* 遇到不支持的字节类型 */
+#define MSGPACK_SCAN_EDEPTH   (-2)    /* 超出最大解析深度 */
+#define MSGPACK_SCAN_EKEY     (-3)    /* 不支持的`Map`key类型 */
+#define MSGPACK_SCAN_EFLOAT   (-4)    /* 浮点数为`INF`或`NaN` */
+#define MSGPACK_SCAN_ESTRING  (-5)    /* 字符串超出解析长度 */
+#define MSGPACK_SCAN_ELSTRING (-6)    /* 超出`max_string` */
+#define MSGPACK_SCAN_ELCOUNT  (-7)    /* 超出`max_elements` */
+#define MSGPACK_SCAN_ELMEMORY (-8)    /* 超出`max_memory` */
+#define MSGPACK_SCAN_ENOMEM   (-9)    /* 内存不足 */
+
+typedef struct msgpack_Scanner {
+  size_t pos; int depth;
+  /* 与解码相同的资源限制(为`0`时不限制, `max_depth`为`0`时使用`USE_MSGPACK_MAX_STACK - 1`), 读到头部时立即检查 */
+  int max_depth; size_t max_string; size_t max_elements; size_t max_memory;
+  size_t elements; size_t memory;   /* 当前值已使用的数量 */
+  uint64_t *stack; int cap;         /* 超出`fixed`后改用堆内存, 由`msgpack_scan_free`释放 */
+  uint64_t fixed[USE_MSGPACK_MAX_STACK];
+} msgpack_Scanner;
+
+#define msgpack_scan_init(S)              ({(S)->pos = 0; (S)->depth = 0; (S)->elements = 0; (S)->memory = 0;})
+
+/* 值的头部信息 */
+#define MSGPACK_KIND_SCALAR   (0)
+#define MSGPACK_KIND_ARRAY    (1)
+#define MSGPACK_KIND_MAP      (2)
+
+typedef struct msgpack_Head {
+  uint8_t type;       /* 首字节 */
+  uint8_t kind;       /* 标量/`Array`/`Map` */
+  size_t hlen;        /* 头部长度 */
+  uint64_t payload;   /* 头部之后的内容长度(不含子元素) */
+  uint64_t count;     /* 容器的元素数量(`Map`为键值对数量) */
+} msgpack_Head;
+
+/* 首字节的处理方式 */
+#define MSGPACK_OP_POSFIX     (0)
+#define MSGPACK_OP_NEGFIX     (1)
+#define MSGPACK_OP_NIL        (2)
+#define MSGPACK_OP_FALSE      (3)
+#define MSGPACK_OP_TRUE       (4)
+#define MSGPACK_OP_FIXSTR     (5)
+#define MSGPACK_OP_STR8       (6)
+#define MSGPACK_OP_STR16      (7)
+#define MSGPACK_OP_STR32      (8)
+#define MSGPACK_OP_FLOAT32    (9)
+#define MSGPACK_OP_FLOAT64    (10)
+#define MSGPACK_OP_UINT8      (11)
+#define MSGPACK_OP_UINT16     (12)
+#define MSGPACK_OP_UINT32     (13)
+#define MSGPACK_OP_UINT64     (14)
+#define MSGPACK_OP_INT8       (15)
+#define MSGPACK_OP_INT16      (16)
+#define MSGPACK_OP_INT32      (17)
+#define MSGPACK_OP_INT64      (18)
+#define MSGPACK_OP_FIXARRAY   (19)
+#define MSGPACK_OP_ARRAY16    (20)
+#define MSGPACK_OP_ARRAY32    (21)
+#define MSGPACK_OP_FIXMAP     (22)
+#define MSGPACK_OP_MAP16      (23)
+#define MSGPACK_OP_MAP32      (24)
+#define MSGPACK_OP_EXT        (25)
+#define MSGPACK_OP_INVALID    (26)
+
+/* 首字节描述表: 解码、扫描与校验共用, 以首字节为索引. */
+typedef struct msgpack_Lead {
+  uint8_t op;         /* `MSGPACK_OP_*` */
+  uint8_t kind;       /* 标量/`Array`/`Map` */
+  uint8_t hlen;       /* 长度字段之前的头部长度(`ext`包含类型字节) */
+  uint8_t lbytes;     /* 长度字段的字节数, 为`0`时长度由`inl`给出 */
+  uint8_t inl;        /* 定长内容的字节数, 或`fix`类型的长度/元素数量 */
+  uint8_t key;        /* 是否可以作为`Map`的`key` */
+} msgpack_Lead;
+
+extern const msgpack_Lead msgpack_leads[256];
+
+int msgpack_scan_head(const char *buffer, size_t bsize, msgpack_Head *H);
+void msgpack_scan_setup(msgpack_Scanner *S);
+void msgpack_scan_free(msgpack_Scanner *S);
+int msgpack_scan(msgpack_Scanner *S, const char *buffer, size_t bsize);
+int msgpack_sizeof(const char *buffer, size_t bsize, size_t *size);
+int msgpack_validate(const char *buffer, size_t bsize, int max_depth, size_t *size);
+size_t msgpack_skip(const char *buffer, size_t bsize);
+const char* msgpack_scan_strerror(int code);
+
+/* 编码`Map`字符串`key`的缓存: 以字符串地址为索引, 保存完整的编码结果. */
+#define MSGPACK_ENCKEY_SIZE       (256)
+#define MSGPACK_ENCKEY_KEYLEN     (31)
+
+typedef struct msgpack_EncKeyCache {
+  struct { const char *key; size_t len; char data[MSGPACK_ENCKEY_KEYLEN + 1]; } slots[MSGPACK_ENCKEY_SIZE];
+} msgpack_EncKeyCache;
+
+/* 扩展类型注册表: 已注册解码函数的类型标记(以`type + 128`为索引)与内置元表的地址 */
+typedef struct msgpack_ExtRegistry {
+  uint8_t decoders[256];
+  const void *timestamp;      /* `lua_Timestamp`元表 */
+  const void *ext;            /* `lua_Ext`元表 */
+  const void *list;           /* `lua_List`元表 */
+  const void *typed;          /* `lua_Typed`元表 */
+  const void *vector;         /* `lua_Vector`元表 */
+} msgpack_ExtRegistry;
+
+/*
+  分散写出: 长度不小于`threshold`的字符串只将头部写入缓冲区, 内容以引用的形式记录在`refs`中,
+  写出时与缓冲区交替组成`iovec`. 被引用的字符串在写出之前一直被锚定.
+*/
+#define MSGPACK_GATHER_SIZE       (xrio_buffer_size)
+
+typedef struct msgpack_GatherRef {
+  size_t pos;         /* 内容在缓冲区中的插入位置 */
+  const char *data;
+  size_t len;
+} msgpack_GatherRef;
+
+typedef struct msgpack_Gather {
+  size_t threshold;
+  size_t count; size_t size;  /* 引用数量/已分配的数量 */
+  size_t bytes;               /* 被引用内容的总长度 */
+  msgpack_GatherRef *refs;
+  int anchor;                 /* 锚定被引用字符串的`Lua`表(绝对栈索引) */
+} msgpack_Gather;
+
+void msgpack_gather_string(lua_State *L, msgpack_Gather *G, xrio_Buffer *B, const char *buffer, size_t bsize);
+void msgpack_gather_truncate(msgpack_Gather *G, size_t pos);
+void msgpack_gather_shift(msgpack_Gather *G, size_t pos, size_t len);
+
+/* 单次编码的上下文 */
+typedef struct msgpack_Encoder {
+  msgpack_EncKeyCache *keys;  /* 为`NULL`时不使用`key`缓存 */
+  int anchor;                 /* 锚定缓存字符串的`Lua`表(绝对栈索引) */
+  msgpack_ExtRegistry *exts;  /* 扩展类型注册表 */
+  int extmeta;                /* 元表 -> { type, encode_fn }(绝对栈索引) */
+  msgpack_Gather *gather;     /* 为`NULL`时复制所有字符串的内容 */
+  int canonical;              /* 规范编码: `Map`的`key`按固定顺序排列 */
+} msgpack_Encoder;
+
+void msgpack_encoder_init(lua_State *L, msgpack_Encoder *E);
+void msgpack_enckey_meta(lua_State *L);
+
+void msgpack_enc_integer(xrio_Buffer *B, lua_Integer i);
+void msgpack_enc_number(xrio_Buffer *B, lua_Number n);
+int  msgpack_enc_strhead(lua_State *L, xrio_Buffer *B, size_t bsize);
+int  msgpack_enc_string(lua_State *L, xrio_Buffer *B, const char*buffer, size_t bsize);
+int  msgpack_enc_length(lua_State *L, xrio_Buffer *B, size_t count, uint8_t fix, uint8_t t16, uint8_t t32);
+int  msgpack_enc_map(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int level);
+int  msgpack_enc_canonical_map(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int level);
+int  msgpack_encode_pcall(lua_State *L, int idx, xrio_Buffer *B, int canonical);
+int  msgpack_encode_hash(lua_State *L, int idx, int canonical);
+void msgpack_enc_value(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B, int level, const char *where);
+int  msgpack_enc_ext(lua_State *L, msgpack_Encoder *E, xrio_Buffer *B);
+
+/* 解码`Map`字符串`key`的缓存: 开放寻址, 槽位冲突时直接覆盖. */
+#define MSGPACK_KEYCACHE_SIZE     (256)
+#define MSGPACK_KEYCACHE_KEYLEN   (64)
+
+typedef struct msgpack_KeyCache {
+  struct { const char *key; size_t len; } slots[MSGPACK_KEYCACHE_SIZE];
+  int anchor;   /* 锚定缓存字符串的`Lua`表(绝对栈索引) */
+} msgpack_KeyCache;
+
+/* 单次解码的上下文 */
+typedef struct msgpack_Decoder {
+  msgpack_KeyCache *keys;   /* 为`NULL`时不使用`key`缓存 */
+  msgpack_ExtRegistry *exts;  /* 遇到第一个扩展类型时才获取 */
+  int max_depth;            /* 最大嵌套层数, 为`0`时使用`USE_MSGPACK_MAX_STACK - 1` */
+  size_t typed;             /* 元素数量不少于此值的数值`Array`解码为`lua_Typed`, 为`0`时不启用 */
+  /* 资源限制(为`0`时不限制), 在创建表或字符串之前检查 */
+  size_t max_elements;      /* 所有容器的元素总数(`Map`按键值对计算) */
+  size_t max_string;        /* 单个字符串的最大字节数 */
+  size_t max_memory;        /* 创建的`Lua`值占用内存的估计值 */
+  size_t elements; size_t memory;   /* 已使用的数量 */
+} msgpack_Decoder;
+
+void msgpack_decode_limits(lua_State *L, int idx, msgpack_Decoder *D);
+int  msgpack_decode_maxdepth(lua_State *L, int idx);
+void msgpack_dec_strlimit(lua_State *L, msgpack_Decoder *D, size_t len);
+
+void msgpack_keycache_init(lua_State *L, msgpack_KeyCache *K);
+
+size_t msgpack_decode_pos(lua_State *L, int idx, size_t bsize);
+
+int msgpack_dec_value(lua_State *L, msgpack_Decoder *D, int level, const char *buffer, size_t bsize);
+int msgpack_dec_map(lua_State *L, msgpack_Decoder *D, int level, const char *buffer, size_t bsize);
+int msgpack_dec_array(lua_State *L, msgpack_Decoder *D, int level, const char *buffer, size_t bsize);
+int msgpack_dec_ext(lua_State *L, msgpack_Decoder *D, const char *buffer, size_t bsize);
+
+/* 连续存储的数值数组(`lua_Typed`), 数据紧随结构体之后. */
+#define MSGPACK_TYPED_INT64   (0)
+#define MSGPACK_TYPED_DOUBLE  (1)
+
+typedef struct msgpack_Typed {
+  size_t count;
+  int type;
+} msgpack_Typed;
+
+#define msgpack_typed_int64(T)   ((int64_t*)((T) + 1))
+#define msgpack_typed_double(T)  ((double*)((T) + 1))
+
+msgpack_Typed* msgpack_typed_new(lua_State *L, int type, size_t count);
+size_t msgpack_dec_typed(lua_State *L, const char *buffer, size_t bsize, size_t count);
+void msgpack_enc_typed(lua_State *L, xrio_Buffer *B, int idx);
+void msgpack_enc_vector(lua_State *L, xrio_Buffer *B, int idx, int canonical);
+int  lmsgpack_vector(lua_State *L);
+void msgpack_typed_meta(lua_State *L);
 
 int lmsgpack_encode(lua_State *L);
+int lmsgpack_encode_to(lua_State *L);
+int lmsgpack_clear_key_cache(lua_State *L);
 int lmsgpack_decode(lua_State *L);
+int lmsgpack_decode_all(lua_State *L);
+int lmsgpack_validate(lua_State *L);
+int lmsgpack_sizeof(lua_State *L);
+
+int  lmsgpack_unpacker(lua_State *L);
+void msgpack_unpacker_meta(lua_State *L);
+
+int  lmsgpack_packer(lua_State *L);
+void msgpack_packer_meta(lua_State *L);
+
+int  lmsgpack_open(lua_State *L);
+void msgpack_reader_meta(lua_State *L);
+
+int  lmsgpack_parallel_scan(lua_State *L);
+
+int  lmsgpack_stats(lua_State *L);
+int  lmsgpack_stats_reset(lua_State *L);
+
+int  msgpack_checkfd(lua_State *L, int idx);
+
+int  lmsgpack_schema(lua_State *L);
+void msgpack_schema_meta(lua_State *L);
+
+int  lmsgpack_view(lua_State *L);
+void msgpack_view_meta(lua_State *L);
+
+/* 路径片段: 字符串`key`或整数(`Array`下标从`1`开始, 或整数`key`) */
+typedef struct msgpack_PathSeg {
+  int type;           /* `LUA_TSTRING`或`LUA_TNUMBER` */
+  const char *key; size_t len;
+  lua_Integer idx;
+} msgpack_PathSeg;
+
+typedef struct msgpack_Path {
+  int count;
+  msgpack_PathSeg segs[1];
+} msgpack_Path;
+
+void msgpack_path_seg(lua_State *L, int idx, msgpack_PathSeg *seg);
+int  msgpack_path_keyeq(const char *buffer, size_t bsize, const msgpack_PathSeg *seg);
+int  msgpack_path_keyhash(const char *buffer, size_t bsize, uint64_t *hash);
+uint64_t msgpack_path_seghash(const msgpack_PathSeg *seg);
+
+int  lmsgpack_get(lua_State *L);
+int  lmsgpack_path(lua_State *L);
+void msgpack_path_meta(lua_State *L);
+
+int  lmsgpack_index(lua_State *L);
+void msgpack_index_meta(lua_State *L);
+
+int  lmsgpack_timestamp(lua_State *L);
+int  lmsgpack_ext(lua_State *L);
+int  lmsgpack_register_ext(lua_State *L);
+void msgpack_ext_meta(lua_State *L);
 
 
 /* 字节序交换 */
 static inline uint16_t xrio_swap16(uint16_t number) {
-  return (__uint16_t) ((((number) >> 8) & 0xff) | (((number) & 0xff) << 8));
+#if defined(__GNUC__)
+  return __builtin_bswap16(number);
+#else
+  return (uint16_t) ((((number) >> 8) & 0xff) | (((number) & 0xff) << 8));
+#endif
 }
 
 static inline uint32_t xrio_swap32(uint32_t number) {
+#if defined(__GNUC__)
+  return __builtin_bswap32(number);
+#else
   return (((number) & 0xff000000u) >> 24) | (((number) & 0x00ff0000u) >> 8) | (((number) & 0x0000ff00u) << 8) | (((number) & 0x000000ffu) << 24);
+#endif
 }
 
 static inline uint64_t xrio_swap64(uint64_t number) {
+#if defined(__GNUC__)
+  return __builtin_bswap64(number);
+#else
   return  (((number) & 0xff00000000000000ull) >> 56)
         | (((number) & 0x00ff000000000000ull) >> 40)
         | (((number) & 0x0000ff0000000000ull) >> 24)
@@ -133,6 +486,7 @@ static inline uint64_t xrio_swap64(uint64_t number) {
         | (((number) & 0x0000000000ff0000ull) << 24)
         | (((number) & 0x000000000000ff00ull) << 40)
         | (((number) & 0x00000000000000ffull) << 56);
+#endif
 }
 
 /* `网络字节序`转换`主机字节序` */
@@ -183,4 +537,33 @@ static inline void xrio_hton64(uint64_t *number) {
 #else
   (void)number;
 #endif
-}
\ No newline at end of file
+}
+
+/* 从任意(未对齐的)地址读取大端整数 */
+static inline uint16_t xrio_load16(const char *buffer) {
+  uint16_t v; memcpy(&v, buffer, 2); xrio_ntoh16(&v);
+  return v;
+}
+
+static inline uint32_t xrio_load32(const char *buffer) {
+  uint32_t v; memcpy(&v, buffer, 4); xrio_ntoh32(&v);
+  return v;
+}
+
+static inline uint64_t xrio_load64(const char *buffer) {
+  uint64_t v; memcpy(&v, buffer, 8); xrio_ntoh64(&v);
+  return v;
+}
+
+/* 向任意(未对齐的)地址写入大端整数 */
+static inline void xrio_store16(char *buffer, uint16_t v) {
+  xrio_hton16(&v); memcpy(buffer, &v, 2);
+}
+
+static inline void xrio_store32(char *buffer, uint32_t v) {
+  xrio_hton32(&v); memcpy(buffer, &v, 4);
+}
+
+static inline void xrio_store64(char *buffer, uint64_t v) {
+  xrio_hton64(&v); memcpy(buffer, &v, 8);
+}
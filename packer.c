@@ -0,0 +1,301 @@
+#include "msgpack.h"
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#if !defined(IOV_MAX)
+  #define IOV_MAX 1024
+#endif
+
+/*
+  可复用的编码器: 缓冲区在多次`pack`之间保留(包括已经扩展到堆上的内存),
+  可以连续写入多个任意类型的值, 也可以不经过`Lua`字符串直接写入文件描述符.
+  启用`gather`后较长的字符串不会被复制到缓冲区, 而是在写出时通过`writev`直接引用.
+*/
+typedef struct msgpack_Packer {
+  size_t len;   /* 已成功编码的字节数(缓冲区) */
+  size_t sent;  /* 已写入文件描述符的字节数(包含被引用的内容) */
+  xrio_Buffer B;
+  msgpack_Gather G;  /* `G.threshold`为`0`时不启用 */
+} msgpack_Packer;
+
+#define msgpack_packer_check(L) ((msgpack_Packer*)luaL_checkudata(L, 1, "lua_Packer"))
+
+/* 编码失败的`pack`可能在已编码的内容之后留下引用 */
+#define msgpack_packer_sync(P) msgpack_gather_truncate(&(P)->G, (P)->len)
+
+/* 获取文件描述符: 支持整数与`io`库的文件对象. */
+int msgpack_checkfd(lua_State *L, int idx) {
+  luaL_Stream *p = luaL_testudata(L, idx, LUA_FILEHANDLE);
+  if (p) {
+    if (!p->f || !p->closef)
+      return luaL_error(L, "[msgpack error]: attempt to use a closed file.");
+    fflush(p->f);
+    return fileno(p->f);
+  }
+  return (int)luaL_checkinteger(L, idx);
+}
+
+/* 写入字符串头部, 并记录内容的引用(锚定栈顶的字符串). */
+void msgpack_gather_string(lua_State *L, msgpack_Gather *G, xrio_Buffer *B, const char *buffer, size_t bsize) {
+  msgpack_enc_strhead(L, B, bsize);
+  if (G->count == G->size) {
+    size_t size = G->size ? G->size << 1 : 16;
+    msgpack_GatherRef *refs = xrio_realloc(G->refs, size * sizeof(msgpack_GatherRef));
+    if (!refs)
+      luaL_error(L, "[msgpack error]: packer out of memory.");
+    G->refs = refs; G->size = size;
+  }
+  G->refs[G->count].pos = xrio_buffgetidx(B);
+  G->refs[G->count].data = buffer;
+  G->refs[G->count].len = bsize;
+  G->count++; G->bytes += bsize;
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, G->anchor, G->count);
+}
+
+/* 缓冲区被回滚到`pos`: 丢弃之后的引用 */
+void msgpack_gather_truncate(msgpack_Gather *G, size_t pos) {
+  while (G->count > 0 && G->refs[G->count - 1].pos > pos)
+    G->bytes -= G->refs[--G->count].len;
+}
+
+/* 缓冲区在`pos`之后插入了`len`字节: 后移之后的引用 */
+void msgpack_gather_shift(msgpack_Gather *G, size_t pos, size_t len) {
+  for (size_t i = G->count; i > 0 && G->refs[i - 1].pos > pos; i--)
+    G->refs[i - 1].pos += len;
+}
+
+/*
+  按顺序遍历跳过前`skip`字节后的所有数据块(缓冲区片段与被引用的字符串交替出现),
+  `ref`为被引用字符串的下标(从`1`开始, 只有完整的引用才会给出), 回调返回`0`时停止遍历.
+*/
+typedef int (*msgpack_packer_chunk)(void *ud, const char *data, size_t len, size_t ref);
+
+static void msgpack_packer_walk(msgpack_Packer *P, size_t skip, msgpack_packer_chunk fn, void *ud) {
+  size_t off = 0, bpos = 0;
+  for (size_t i = 0; i <= P->G.count; i++)
+  {
+    size_t end = i < P->G.count ? P->G.refs[i].pos : P->len;
+    for (int part = 0; part < 2; part++)
+    {
+      const char *data; size_t len;
+      if (part == 0) {
+        data = P->B.b + bpos; len = end - bpos;
+      } else {
+        if (i == P->G.count)
+          break;
+        data = P->G.refs[i].data; len = P->G.refs[i].len;
+      }
+      if (off + len <= skip) {
+        off += len;
+        continue;
+      }
+      size_t start = skip > off ? skip - off : 0;
+      off += len;
+      if (!fn(ud, data + start, len - start, part == 1 && start == 0 ? i + 1 : 0))
+        return;
+    }
+    bpos = end;
+  }
+}
+
+/* 清空已写出的内容与所有引用 */
+static void msgpack_packer_clear(lua_State *L, msgpack_Packer *P) {
+  P->len = P->sent = 0;
+  xrio_buffreset((&P->B), 0);
+  if (P->G.count) {
+    P->G.count = P->G.bytes = 0;
+    lua_newtable(L);
+    lua_setuservalue(L, 1);
+  }
+}
+
+/* 依次编码所有参数, 某个值编码失败时会丢弃该次调用写入的所有内容. */
+static int msgpack_packer_pack(lua_State *L) {
+  msgpack_Packer *P = msgpack_packer_check(L);
+  int top = lua_gettop(L);
+  msgpack_Encoder E;
+  msgpack_encoder_init(L, &E);
+  xrio_buffreset((&P->B), P->len);
+  if (P->G.threshold) {
+    msgpack_packer_sync(P);
+    lua_getuservalue(L, 1);
+    P->G.anchor = lua_gettop(L);
+    E.gather = &P->G;
+  }
+  size_t bytes = P->G.bytes;
+  for (int idx = 2; idx <= top; idx++)
+  {
+    lua_pushvalue(L, idx);
+    msgpack_enc_value(L, &E, &P->B, 0, "packer");
+    lua_pop(L, 1);
+  }
+  msgpack_stats_message(1, xrio_buffgetidx((&P->B)) - P->len + P->G.bytes - bytes);
+  P->len = xrio_buffgetidx((&P->B));
+  lua_settop(L, 1);
+  return 1;
+}
+
+/* 清空缓冲区, 但保留已分配的内存. */
+static int msgpack_packer_reset(lua_State *L) {
+  msgpack_Packer *P = msgpack_packer_check(L);
+  msgpack_packer_clear(L, P);
+  return 0;
+}
+
+static int msgpack_packer_addchunk(void *ud, const char *data, size_t len, size_t ref) {
+  (void)ref;
+  xrio_addlstring((xrio_Buffer*)ud, data, len);
+  return 1;
+}
+
+/* 以`Lua`字符串的形式返回尚未写出的内容 */
+static int msgpack_packer_tostring(lua_State *L) {
+  msgpack_Packer *P = msgpack_packer_check(L);
+  msgpack_packer_sync(P);
+  if (!P->G.count) {
+    lua_pushlstring(L, P->B.b + P->sent, P->len - P->sent);
+    return 1;
+  }
+  xrio_Buffer B;
+  xrio_buffinit(L, &B);
+  msgpack_packer_walk(P, P->sent, msgpack_packer_addchunk, &B);
+  xrio_pushresult(&B);
+  return 1;
+}
+
+typedef struct msgpack_PackerSegs {
+  lua_State *L; int anchor; lua_Integer n;
+} msgpack_PackerSegs;
+
+static int msgpack_packer_addseg(void *ud, const char *data, size_t len, size_t ref) {
+  msgpack_PackerSegs *S = ud;
+  if (!len)
+    return 1;
+  if (ref)
+    lua_rawgeti(S->L, S->anchor, ref);    /* 直接返回被引用的字符串 */
+  else
+    lua_pushlstring(S->L, data, len);
+  lua_rawseti(S->L, -2, ++S->n);
+  return 1;
+}
+
+/* 以字符串列表的形式返回尚未写出的内容(被引用的字符串不会被复制), 可以直接交给支持分散写出的接口. */
+static int msgpack_packer_segments(lua_State *L) {
+  msgpack_Packer *P = msgpack_packer_check(L);
+  msgpack_packer_sync(P);
+  lua_settop(L, 1);
+  lua_getuservalue(L, 1);
+  msgpack_PackerSegs S = { .L = L, .anchor = lua_gettop(L), .n = 0 };
+  lua_createtable(L, P->G.count * 2 + 1, 0);
+  msgpack_packer_walk(P, P->sent, msgpack_packer_addseg, &S);
+  return 1;
+}
+
+typedef struct msgpack_PackerIov {
+  struct iovec iov[IOV_MAX]; int n;
+} msgpack_PackerIov;
+
+static int msgpack_packer_addiov(void *ud, const char *data, size_t len, size_t ref) {
+  msgpack_PackerIov *V = ud; (void)ref;
+  if (len) {
+    V->iov[V->n].iov_base = (void*)data; V->iov[V->n].iov_len = len;
+    V->n++;
+  }
+  return V->n < IOV_MAX;
+}
+
+/* 将尚未写出的内容写入文件描述符, 返回本次写入的字节数; 全部写出后自动清空缓冲区. */
+static int msgpack_packer_write(lua_State *L) {
+  msgpack_Packer *P = msgpack_packer_check(L);
+  int fd = msgpack_checkfd(L, 2);
+  msgpack_packer_sync(P);
+  size_t total = 0, size = P->len + P->G.bytes;
+  msgpack_PackerIov V;
+  while (P->sent < size)
+  {
+    V.n = 0;
+    msgpack_packer_walk(P, P->sent, msgpack_packer_addiov, &V);
+    ssize_t n = writev(fd, V.iov, V.n);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      lua_pushnil(L);
+      lua_pushstring(L, strerror(errno));
+      return 2;
+    }
+    P->sent += n; total += n;
+  }
+  if (P->sent == size)
+    msgpack_packer_clear(L, P);
+  lua_pushinteger(L, total);
+  return 1;
+}
+
+/* 尚未写出的字节数 */
+static int msgpack_packer_len(lua_State *L) {
+  msgpack_Packer *P = msgpack_packer_check(L);
+  msgpack_packer_sync(P);
+  lua_pushinteger(L, P->len + P->G.bytes - P->sent);
+  return 1;
+}
+
+static int msgpack_packer_gc(lua_State *L) {
+  msgpack_Packer *P = msgpack_packer_check(L);
+  P->B.L = NULL; xrio_pushresult(&P->B);
+  P->len = P->sent = 0;
+  if (P->G.refs)
+    xrio_free(P->G.refs);
+  P->G.refs = NULL; P->G.count = P->G.size = P->G.bytes = 0;
+  return 0;
+}
+
+/* 创建编码器: msgpack.packer([{ gather = true | threshold }]) */
+int lmsgpack_packer(lua_State *L) {
+  size_t threshold = 0;
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_getfield(L, 1, "gather");
+    if (lua_isinteger(L, -1)) {
+      lua_Integer n = lua_tointeger(L, -1);
+      luaL_argcheck(L, n > 0, 1, "gather threshold must be positive");
+      threshold = (size_t)n;
+    } else if (lua_toboolean(L, -1))
+      threshold = MSGPACK_GATHER_SIZE;
+    lua_pop(L, 1);
+  }
+  msgpack_Packer *P = lua_newuserdata(L, sizeof(msgpack_Packer));
+  P->len = P->sent = 0;
+  xrio_buffinit(L, &P->B);
+  memset(&P->G, 0, sizeof(msgpack_Gather));
+  P->G.threshold = threshold;
+  luaL_setmetatable(L, "lua_Packer");
+  if (threshold) {
+    lua_newtable(L);
+    lua_setuservalue(L, -2);
+  }
+  return 1;
+}
+
+void msgpack_packer_meta(lua_State *L) {
+  luaL_Reg packer_libs[] = {
+    {"pack", msgpack_packer_pack},
+    {"reset", msgpack_packer_reset},
+    {"write", msgpack_packer_write},
+    {"tostring", msgpack_packer_tostring},
+    {"segments", msgpack_packer_segments},
+    {NULL, NULL}
+  };
+  luaL_newmetatable(L, "lua_Packer");
+  luaL_newlib(L, packer_libs);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, msgpack_packer_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, msgpack_packer_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
@@ -0,0 +1,214 @@
+#include "msgpack.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+  多线程预扫描首尾相连的记录: 查找记录边界与校验都不需要`Lua`, 所以可以交给多个线程完成,
+  `Lua`线程之后只需要按偏移量逐条解码.
+
+  `msgpack`不能从任意位置重新同步, 所以除第一段以外, 每个线程都从所在分段内"看起来像记录起始"的位置开始推测:
+  首字节与第一条记录的容器类型相同, 并且之后连续`MSGPACK_PSCAN_CONFIRM`条记录都能通过校验.
+  所有线程结束后按顺序拼接: 上一段真实的记录链落在本段的某个边界上时, 之后的结果都是确定的, 直接采用;
+  否则(推测失败)从真实的位置重新顺序扫描该分段. 所以结果总是与顺序扫描完全一致.
+*/
+#define MSGPACK_PSCAN_CHUNK     (1 << 20)   /* 每个线程至少处理的字节数 */
+#define MSGPACK_PSCAN_WINDOW    (1 << 20)   /* 推测时单条记录的最大长度 */
+#define MSGPACK_PSCAN_CONFIRM   (4)
+#define MSGPACK_PSCAN_THREADS   (64)
+
+typedef struct msgpack_ScanTask {
+  const char *buffer; size_t bsize;
+  size_t start, end;    /* 分段: 只记录起始位置位于[start, end)内的记录 */
+  int speculative;
+  size_t *offsets; size_t count; size_t cap;
+  size_t next;          /* 最后一条记录之后的位置 */
+  int err; size_t errpos;  /* 格式错误: `err`不为`MSGPACK_SCAN_DONE` */
+  int oom;
+} msgpack_ScanTask;
+
+static inline int msgpack_pscan_push(msgpack_ScanTask *T, size_t pos) {
+  if (T->count == T->cap) {
+    size_t cap = T->cap ? T->cap << 1 : 1024;
+    size_t *offsets = xrio_realloc(T->offsets, cap * sizeof(size_t));
+    if (!offsets)
+      return 0;
+    T->offsets = offsets; T->cap = cap;
+  }
+  T->offsets[T->count++] = pos;
+  return 1;
+}
+
+/* 在[pos, end)内查找推测的记录起始位置, 找不到时返回`end`. */
+static size_t msgpack_pscan_guess(msgpack_ScanTask *T, size_t pos, uint8_t kind) {
+  for (; pos < T->end; pos++)
+  {
+    if (msgpack_leads[(uint8_t)T->buffer[pos]].kind != kind)
+      continue;
+    size_t p = pos, size; int n;
+    for (n = 0; n < MSGPACK_PSCAN_CONFIRM && p < T->bsize; n++, p += size)
+    {
+      size_t window = T->bsize - p < MSGPACK_PSCAN_WINDOW ? T->bsize - p : MSGPACK_PSCAN_WINDOW;
+      if (msgpack_leads[(uint8_t)T->buffer[p]].kind != kind || msgpack_validate(T->buffer + p, window, 0, &size) != MSGPACK_SCAN_DONE)
+        break;
+    }
+    if (n == MSGPACK_PSCAN_CONFIRM || p == T->bsize)
+      return pos;
+  }
+  return T->end;
+}
+
+static void* msgpack_pscan_worker(void *arg) {
+  msgpack_ScanTask *T = arg;
+  uint8_t kind = msgpack_leads[(uint8_t)T->buffer[0]].kind;
+  size_t pos = T->speculative ? msgpack_pscan_guess(T, T->start, kind) : T->start;
+  while (pos < T->end)
+  {
+    size_t size;
+    int ret = msgpack_validate(T->buffer + pos, T->bsize - pos, 0, &size);
+    if (ret != MSGPACK_SCAN_DONE) {
+      if (T->speculative) {
+        /* 可能是推测错误, 也可能是真实的错误: 丢弃之前的结果重新推测, 不会越过错误的记录 */
+        T->count = 0;
+        pos = msgpack_pscan_guess(T, pos + 1, kind);
+        continue;
+      }
+      T->err = ret; T->errpos = pos;
+      break;
+    }
+    if (!msgpack_pscan_push(T, pos)) {
+      T->oom = 1;
+      break;
+    }
+    pos += size;
+  }
+  T->next = pos;
+  return NULL;
+}
+
+/* 在已排序的`offsets`中查找`pos`, 不存在时返回`count` */
+static size_t msgpack_pscan_search(const msgpack_ScanTask *T, size_t pos) {
+  size_t lo = 0, hi = T->count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (T->offsets[mid] < pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < T->count && T->offsets[lo] == pos ? lo : T->count;
+}
+
+static void msgpack_pscan_free(msgpack_ScanTask *tasks, int nthreads) {
+  for (int i = 0; i < nthreads; i++)
+    if (tasks[i].offsets)
+      xrio_free(tasks[i].offsets);
+}
+
+/* 按顺序拼接各个分段的结果, 将所有记录的位置(从`1`开始)写入`out`(格式错误记录在`out->err`中), 内存不足时返回`0`. */
+static int msgpack_pscan_stitch(msgpack_ScanTask *tasks, int nthreads, msgpack_ScanTask *out) {
+  size_t pos = 0;
+  for (int i = 0; i < nthreads; i++)
+  {
+    msgpack_ScanTask *T = &tasks[i];
+    if (T->oom)
+      return 0;
+    if (pos >= T->end)
+      continue;   /* 上一条记录跨越了整个分段 */
+    size_t j = msgpack_pscan_search(T, pos);
+    if (j < T->count || (!T->speculative && T->start == pos)) {
+      /* 真实的记录链与该分段的结果重合 */
+      for (; j < T->count; j++)
+        if (!msgpack_pscan_push(out, T->offsets[j] + 1))
+          return 0;
+      if (T->err != MSGPACK_SCAN_DONE) {
+        out->err = T->err; out->errpos = T->errpos;
+        return 1;
+      }
+      pos = T->next;
+      continue;
+    }
+    /* 推测失败: 从真实的位置重新扫描 */
+    while (pos < T->end)
+    {
+      size_t size;
+      int ret = msgpack_validate(T->buffer + pos, T->bsize - pos, 0, &size);
+      if (ret != MSGPACK_SCAN_DONE) {
+        out->err = ret; out->errpos = pos;
+        return 1;
+      }
+      if (!msgpack_pscan_push(out, pos + 1))
+        return 0;
+      pos += size;
+    }
+  }
+  return 1;
+}
+
+/*
+  多线程预扫描: msgpack.parallel_scan(buffer [, nthreads])
+  成功返回所有记录的起始位置(`lua_Typed`, 可以直接作为`msgpack.decode`的`pos`参数);
+  某条记录格式错误时返回`false`、错误信息与该记录的起始位置.
+*/
+int lmsgpack_parallel_scan(lua_State *L) {
+  size_t bsize;
+  const char *buffer = luaL_checklstring(L, 1, &bsize);
+  lua_Integer nthreads = luaL_optinteger(L, 2, 0);
+  if (nthreads <= 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpu > 0 ? ncpu : 1;
+  }
+  if ((size_t)nthreads > bsize / MSGPACK_PSCAN_CHUNK)
+    nthreads = bsize / MSGPACK_PSCAN_CHUNK;
+  if (nthreads > MSGPACK_PSCAN_THREADS)
+    nthreads = MSGPACK_PSCAN_THREADS;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  msgpack_ScanTask tasks[MSGPACK_PSCAN_THREADS]; pthread_t tids[MSGPACK_PSCAN_THREADS]; int started[MSGPACK_PSCAN_THREADS];
+  memset(tasks, 0, sizeof(msgpack_ScanTask) * nthreads);
+  size_t chunk = bsize / nthreads;
+  for (int i = 0; i < nthreads; i++)
+  {
+    tasks[i].buffer = buffer; tasks[i].bsize = bsize;
+    tasks[i].start = chunk * i; tasks[i].end = i + 1 == nthreads ? bsize : chunk * (i + 1);
+    tasks[i].speculative = i > 0;
+    tasks[i].err = MSGPACK_SCAN_DONE;
+  }
+  /* 第一段在当前线程内完成, 线程创建失败时同样退回当前线程 */
+  for (int i = 1; i < nthreads; i++)
+    started[i] = pthread_create(&tids[i], NULL, msgpack_pscan_worker, &tasks[i]) == 0;
+  if (bsize)
+    msgpack_pscan_worker(&tasks[0]);
+  for (int i = 1; i < nthreads; i++)
+  {
+    if (started[i])
+      pthread_join(tids[i], NULL);
+    else
+      msgpack_pscan_worker(&tasks[i]);
+  }
+
+  msgpack_ScanTask out; memset(&out, 0, sizeof(out));
+  out.err = MSGPACK_SCAN_DONE;
+  int ok = msgpack_pscan_stitch(tasks, nthreads, &out);
+  msgpack_pscan_free(tasks, nthreads);
+  if (!ok) {
+    if (out.offsets)
+      xrio_free(out.offsets);
+    return luaL_error(L, "[msgpack error]: parallel_scan out of memory.");
+  }
+  if (out.err != MSGPACK_SCAN_DONE) {
+    if (out.offsets)
+      xrio_free(out.offsets);
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, msgpack_scan_strerror(out.err));
+    lua_pushinteger(L, out.errpos + 1);
+    return 3;
+  }
+  msgpack_Typed *T = msgpack_typed_new(L, MSGPACK_TYPED_INT64, out.count);
+  for (size_t i = 0; i < out.count; i++)
+    msgpack_typed_int64(T)[i] = (int64_t)out.offsets[i];
+  if (out.offsets)
+    xrio_free(out.offsets);
+  return 1;
+}
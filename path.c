@@ -0,0 +1,228 @@
+#include "msgpack.h"
+
+/*
+  按路径提取字段: 直接在编码数据上逐层查找, 不匹配的`key`与整棵无关的子树都通过`msgpack_skip`跳过,
+  查找过程中不会向`Lua`栈压入任何值, 只有最终找到的目标值才会被解码.
+*/
+#define MSGPACK_PATH_FOUND      ( 1)
+#define MSGPACK_PATH_NOTFOUND   ( 0)
+#define MSGPACK_PATH_EBYTE      (-1)
+
+/* 读取整数类型的值, 不是整数时返回`0`. */
+static inline int msgpack_path_integer(const char *buffer, size_t bsize, const msgpack_Head *H, lua_Integer *out) {
+  uint8_t t = H->type;
+  if (t <= 0x7f || t >= 0xe0) {   /* fixint */
+    *out = (int8_t)t;
+    return 1;
+  }
+  if (t < MSG_TYPE_UINT8 || t > MSG_TYPE_INT64 || bsize - 1 < H->payload)
+    return 0;
+  buffer++;
+  switch (t)
+  {
+    case MSG_TYPE_UINT8: *out = *(uint8_t*)buffer; return 1;
+    case MSG_TYPE_INT8:  *out = *(int8_t*)buffer; return 1;
+    case MSG_TYPE_UINT16: case MSG_TYPE_INT16:
+      {
+        uint16_t v; memcpy(&v, buffer, 2); xrio_ntoh16(&v);
+        *out = t == MSG_TYPE_UINT16 ? (lua_Integer)v : (lua_Integer)(int16_t)v;
+        return 1;
+      }
+    case MSG_TYPE_UINT32: case MSG_TYPE_INT32:
+      {
+        uint32_t v; memcpy(&v, buffer, 4); xrio_ntoh32(&v);
+        *out = t == MSG_TYPE_UINT32 ? (lua_Integer)v : (lua_Integer)(int32_t)v;
+        return 1;
+      }
+    default:
+      {
+        uint64_t v; memcpy(&v, buffer, 8); xrio_ntoh64(&v);
+        *out = (lua_Integer)v;
+        return 1;
+      }
+  }
+}
+
+/* 比较`buffer`处编码的`key`与路径片段是否相等 */
+int msgpack_path_keyeq(const char *buffer, size_t bsize, const msgpack_PathSeg *seg) {
+  msgpack_Head H;
+  if (msgpack_scan_head(buffer, bsize, &H) != MSGPACK_SCAN_DONE || H.kind != MSGPACK_KIND_SCALAR)
+    return 0;
+  if (seg->type == LUA_TSTRING) {
+    uint8_t t = H.type;
+    if (!((t >= 0xa0 && t <= 0xbf) || (t >= MSG_TYPE_STR8 && t <= MSG_TYPE_STR32) || (t >= MSG_TYPE_BIN8 && t <= MSG_TYPE_BIN32)))
+      return 0;
+    return H.payload == seg->len && bsize - H.hlen >= seg->len && !memcmp(buffer + H.hlen, seg->key, seg->len);
+  }
+  lua_Integer v;
+  return msgpack_path_integer(buffer, bsize, &H, &v) && v == seg->idx;
+}
+
+/* 路径片段的哈希值(`FNV-1a`), 字符串与整数分开计算 */
+uint64_t msgpack_path_seghash(const msgpack_PathSeg *seg) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  if (seg->type == LUA_TNUMBER)
+    return ((uint64_t)seg->idx ^ h) * 0x9e3779b97f4a7c15ULL >> 7;
+  for (size_t i = 0; i < seg->len; i++)
+    h = (h ^ (uint8_t)seg->key[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+/* 编码的`key`的哈希值, 与`msgpack_path_keyeq`相等的`key`哈希值相同; 不能被路径匹配的`key`返回`0`. */
+int msgpack_path_keyhash(const char *buffer, size_t bsize, uint64_t *hash) {
+  msgpack_Head H; lua_Integer v;
+  if (msgpack_scan_head(buffer, bsize, &H) != MSGPACK_SCAN_DONE || H.kind != MSGPACK_KIND_SCALAR)
+    return 0;
+  uint8_t t = H.type;
+  if ((t >= 0xa0 && t <= 0xbf) || (t >= MSG_TYPE_STR8 && t <= MSG_TYPE_STR32) || (t >= MSG_TYPE_BIN8 && t <= MSG_TYPE_BIN32)) {
+    if (bsize - H.hlen < H.payload)
+      return 0;
+    msgpack_PathSeg seg = { .type = LUA_TSTRING, .key = buffer + H.hlen, .len = H.payload };
+    *hash = msgpack_path_seghash(&seg);
+    return 1;
+  }
+  if (!msgpack_path_integer(buffer, bsize, &H, &v))
+    return 0;
+  msgpack_PathSeg seg = { .type = LUA_TNUMBER, .idx = v };
+  *hash = msgpack_path_seghash(&seg);
+  return 1;
+}
+
+/* 在`buffer`处的容器内查找路径片段, 找到时更新`buffer`与`bsize`为目标元素的位置. */
+static int msgpack_path_step(const char **buffer, size_t *bsize, const msgpack_PathSeg *seg) {
+  msgpack_Head H; const char *p = *buffer; size_t n = *bsize; size_t len;
+  if (msgpack_scan_head(p, n, &H) != MSGPACK_SCAN_DONE)
+    return MSGPACK_PATH_EBYTE;
+  if (H.kind == MSGPACK_KIND_SCALAR)
+    return MSGPACK_PATH_NOTFOUND;
+  p += H.hlen; n -= H.hlen;
+
+  if (H.kind == MSGPACK_KIND_ARRAY) {
+    if (seg->type != LUA_TNUMBER || seg->idx < 1 || (uint64_t)seg->idx > H.count)
+      return MSGPACK_PATH_NOTFOUND;
+    for (lua_Integer i = 1; i < seg->idx; i++) {
+      if (!(len = msgpack_skip(p, n)))
+        return MSGPACK_PATH_EBYTE;
+      p += len; n -= len;
+    }
+    *buffer = p; *bsize = n;
+    return MSGPACK_PATH_FOUND;
+  }
+
+  for (uint64_t i = 0; i < H.count; i++)
+  {
+    int eq = msgpack_path_keyeq(p, n, seg);
+    if (!(len = msgpack_skip(p, n)))
+      return MSGPACK_PATH_EBYTE;
+    p += len; n -= len;
+    if (eq) {
+      *buffer = p; *bsize = n;
+      return MSGPACK_PATH_FOUND;
+    }
+    if (!(len = msgpack_skip(p, n)))
+      return MSGPACK_PATH_EBYTE;
+    p += len; n -= len;
+  }
+  return MSGPACK_PATH_NOTFOUND;
+}
+
+/* 将栈上`idx`处的参数转换为路径片段 */
+void msgpack_path_seg(lua_State *L, int idx, msgpack_PathSeg *seg) {
+  if (lua_type(L, idx) == LUA_TSTRING) {
+    seg->type = LUA_TSTRING;
+    seg->key = lua_tolstring(L, idx, &seg->len);
+  } else if (lua_isinteger(L, idx)) {
+    seg->type = LUA_TNUMBER;
+    seg->idx = lua_tointeger(L, idx);
+  } else
+    luaL_argerror(L, idx, "path key must be a string or an integer");
+}
+
+/* 解码找到的目标值 */
+static int msgpack_path_result(lua_State *L, int ret, const char *buffer, size_t bsize) {
+  if (ret == MSGPACK_PATH_NOTFOUND)
+    return 0;
+  if (ret == MSGPACK_PATH_EBYTE)
+    return luaL_error(L, "[msgpack decode]: Insufficient remaining byte array or unknown byte type.");
+  msgpack_Decoder D = { .keys = NULL };
+  msgpack_dec_value(L, &D, 1, buffer, bsize);
+  return 1;
+}
+
+static int msgpack_get_init(lua_State *L) {
+  size_t bsize;
+  const char *buffer = luaL_checklstring(L, 1, &bsize);
+  int top = lua_gettop(L); int ret = MSGPACK_PATH_FOUND;
+  for (int idx = 2; idx <= top && ret == MSGPACK_PATH_FOUND; idx++)
+  {
+    msgpack_PathSeg seg;
+    msgpack_path_seg(L, idx, &seg);
+    ret = msgpack_path_step(&buffer, &bsize, &seg);
+  }
+  return msgpack_path_result(L, ret, buffer, bsize);
+}
+
+static int msgpack_path_get_init(lua_State *L) {
+  msgpack_Path *P = lua_touserdata(L, 1);
+  size_t bsize;
+  const char *buffer = luaL_checklstring(L, 2, &bsize);
+  int ret = MSGPACK_PATH_FOUND;
+  for (int i = 0; i < P->count && ret == MSGPACK_PATH_FOUND; i++)
+    ret = msgpack_path_step(&buffer, &bsize, &P->segs[i]);
+  return msgpack_path_result(L, ret, buffer, bsize);
+}
+
+/* 使用保护模式调用, 未找到时返回`nil`, 格式错误时返回`false`与错误信息. */
+static int msgpack_path_pcall(lua_State *L, lua_CFunction f) {
+  int top = lua_gettop(L);
+  lua_pushcfunction(L, f);
+  lua_insert(L, 1);
+  if (LUA_OK == lua_pcall(L, top, 1, 0))
+    return 1;
+  lua_pushboolean(L, 0);
+  lua_pushvalue(L, -2);
+  return 2;
+}
+
+/* 提取字段: msgpack.get(buffer, "a", "b", 3) */
+int lmsgpack_get(lua_State *L) {
+  luaL_checkstring(L, 1);
+  return msgpack_path_pcall(L, msgpack_get_init);
+}
+
+/* 提取字段: path:get(buffer) */
+static int msgpack_path_get(lua_State *L) {
+  luaL_checkudata(L, 1, "lua_Path");
+  luaL_checkstring(L, 2);
+  lua_settop(L, 2);
+  return msgpack_path_pcall(L, msgpack_path_get_init);
+}
+
+/* 预编译路径: msgpack.path("a", "b", 3) */
+int lmsgpack_path(lua_State *L) {
+  int count = lua_gettop(L);
+  luaL_argcheck(L, count >= 1, 1, "path need at least one key");
+  msgpack_Path *P = lua_newuserdata(L, sizeof(msgpack_Path) + sizeof(msgpack_PathSeg) * (count - 1));
+  P->count = count;
+  lua_createtable(L, count, 0);
+  for (int idx = 1; idx <= count; idx++)
+  {
+    msgpack_path_seg(L, idx, &P->segs[idx - 1]);
+    lua_pushvalue(L, idx);
+    lua_rawseti(L, -2, idx);
+  }
+  lua_setuservalue(L, -2);  /* 锚定路径中的字符串 */
+  luaL_setmetatable(L, "lua_Path");
+  return 1;
+}
+
+void msgpack_path_meta(lua_State *L) {
+  luaL_Reg path_libs[] = {
+    {"get", msgpack_path_get},
+    {NULL, NULL}
+  };
+  luaL_newmetatable(L, "lua_Path");
+  luaL_newlib(L, path_libs);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+}
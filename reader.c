@@ -0,0 +1,273 @@
+#include "msgpack.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+  记录文件读取器: 以`mmap`映射由首尾相连的消息组成的文件(例如只追加的日志), 直接从映射的内存中解码,
+  不需要先把整个文件读入`Lua`字符串. 记录的起始位置在遍历或`seek`时按需记录, 之后可以随机访问.
+  文件末尾不完整的记录(写入中断)会被当作文件结束.
+*/
+typedef struct msgpack_Reader {
+  const char *data;   /* 映射的起始地址, 文件为空或已关闭时为`NULL` */
+  size_t size;
+  size_t pos;         /* 下一条记录的起始位置 */
+  size_t idx;         /* 下一条记录的序号(从`0`开始) */
+  size_t *offsets;    /* 已知的记录起始位置: offsets[i]为第`i`条记录 */
+  size_t indexed; size_t cap;
+  int complete;       /* 是否已经扫描到文件末尾 */
+  int key_cache;      /* 是否启用`key`缓存(在多条记录之间共享) */
+  msgpack_KeyCache K;
+} msgpack_Reader;
+
+#define msgpack_reader_check(L) ((msgpack_Reader*)luaL_checkudata(L, 1, "lua_Reader"))
+
+/* 记录第`indexed`条记录的起始位置 */
+static inline void msgpack_reader_push(lua_State *L, msgpack_Reader *R, size_t pos) {
+  if (R->indexed == R->cap) {
+    size_t cap = R->cap ? R->cap << 1 : 1024;
+    size_t *offsets = xrio_realloc(R->offsets, cap * sizeof(size_t));
+    if (!offsets)
+      luaL_error(L, "[msgpack error]: reader out of memory.");
+    R->offsets = offsets; R->cap = cap;
+  }
+  R->offsets[R->indexed++] = pos;
+}
+
+/*
+  获取`pos`处记录的长度: 成功返回`MSGPACK_SCAN_DONE`, 到达文件末尾(或末尾的记录不完整)返回`MSGPACK_SCAN_AGAIN`.
+  第一次经过最后一条已知的记录时顺便记录下一条记录的起始位置.
+*/
+static int msgpack_reader_sizeof(lua_State *L, msgpack_Reader *R, size_t idx, size_t pos, size_t *size) {
+  if (pos >= R->size) {
+    R->complete = 1;
+    return MSGPACK_SCAN_AGAIN;
+  }
+  int ret = msgpack_sizeof(R->data + pos, R->size - pos, size);
+  if (ret == MSGPACK_SCAN_AGAIN)
+    R->complete = 1;
+  else if (ret == MSGPACK_SCAN_DONE && idx + 1 == R->indexed) {
+    if (pos + *size < R->size)
+      msgpack_reader_push(L, R, pos + *size);
+    else
+      R->complete = 1;
+  }
+  return ret;
+}
+
+/* 扫描直到第`n`条记录(从`0`开始)的起始位置已知或到达文件末尾 */
+static void msgpack_reader_index(lua_State *L, msgpack_Reader *R, size_t n) {
+  while (R->indexed <= n && !R->complete)
+  {
+    size_t size;
+    int ret = msgpack_reader_sizeof(L, R, R->indexed - 1, R->offsets[R->indexed - 1], &size);
+    if (ret != MSGPACK_SCAN_DONE && ret != MSGPACK_SCAN_AGAIN)
+      luaL_error(L, "%s", msgpack_scan_strerror(ret));
+  }
+}
+
+/* 扫描到文件末尾后的记录总数(不包括末尾不完整的记录) */
+static size_t msgpack_reader_total(msgpack_Reader *R) {
+  size_t size, count = R->indexed;
+  if (count && msgpack_sizeof(R->data + R->offsets[count - 1], R->size - R->offsets[count - 1], &size) != MSGPACK_SCAN_DONE)
+    count--;
+  return count;
+}
+
+static int msgpack_reader_decode(lua_State *L) {
+  msgpack_Reader *R = lua_touserdata(L, 1);
+  const char *buffer = lua_touserdata(L, 2);
+  msgpack_Decoder D = { .keys = NULL };
+  if (R->key_cache) {
+    lua_getuservalue(L, 1);
+    R->K.anchor = lua_gettop(L);
+    D.keys = &R->K;
+  }
+  msgpack_dec_value(L, &D, 0, buffer, (size_t)lua_tointeger(L, 3));
+  return 1;
+}
+
+/* 解码下一条记录, 到达文件末尾时返回`nil`; 记录格式错误时返回`false`与错误信息. */
+static int msgpack_reader_next(lua_State *L) {
+  msgpack_Reader *R = msgpack_reader_check(L);
+  size_t size;
+  if (!R->data)
+    return 0;
+  int ret = msgpack_reader_sizeof(L, R, R->idx, R->pos, &size);
+  if (ret == MSGPACK_SCAN_AGAIN)
+    return 0;
+  if (ret != MSGPACK_SCAN_DONE) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, msgpack_scan_strerror(ret));
+    return 2;
+  }
+  const char *buffer = R->data + R->pos;
+  R->pos += size; R->idx++;
+  /* 使用保护模式调用 */
+  lua_pushcfunction(L, msgpack_reader_decode);
+  lua_pushvalue(L, 1);
+  lua_pushlightuserdata(L, (void*)buffer);
+  lua_pushinteger(L, size);
+  if (LUA_OK == lua_pcall(L, 3, 1, 0))
+    return 1;
+  lua_pushboolean(L, 0);
+  lua_insert(L, -2);
+  return 2;
+}
+
+static int msgpack_reader_iter(lua_State *L) {
+  lua_settop(L, 1);
+  int nret = msgpack_reader_next(L);
+  if (nret == 2)
+    return lua_error(L);  /* 记录格式错误时无法继续遍历 */
+  return nret;
+}
+
+/* 遍历剩余的记录(记录格式错误时抛出异常): for record in reader:records() do ... end */
+static int msgpack_reader_records(lua_State *L) {
+  msgpack_reader_check(L);
+  lua_pushcfunction(L, msgpack_reader_iter);
+  lua_pushvalue(L, 1);
+  return 2;
+}
+
+/* 记录总数(不包括末尾不完整的记录), 记录格式错误时返回`false`与错误信息. */
+static int msgpack_reader_count_init(lua_State *L) {
+  msgpack_Reader *R = lua_touserdata(L, 1);
+  msgpack_reader_index(L, R, SIZE_MAX - 1);
+  lua_pushinteger(L, msgpack_reader_total(R));
+  return 1;
+}
+
+static int msgpack_reader_count(lua_State *L) {
+  msgpack_Reader *R = msgpack_reader_check(L);
+  if (!R->data) {
+    lua_pushinteger(L, 0);
+    return 1;
+  }
+  lua_pushcfunction(L, msgpack_reader_count_init);
+  lua_pushvalue(L, 1);
+  if (LUA_OK == lua_pcall(L, 1, 1, 0))
+    return 1;
+  lua_pushboolean(L, 0);
+  lua_insert(L, -2);
+  return 2;
+}
+
+/* 将读取位置移动到第`n`条记录(从`1`开始), 成功返回`true`, 超出范围返回`nil`. */
+static int msgpack_reader_seek_init(lua_State *L) {
+  msgpack_Reader *R = lua_touserdata(L, 1);
+  size_t n = (size_t)lua_tointeger(L, 2) - 1;
+  msgpack_reader_index(L, R, n);
+  if (n >= R->indexed || (R->complete && n >= msgpack_reader_total(R)))
+    return 0;
+  R->idx = n; R->pos = R->offsets[n];
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static int msgpack_reader_seek(lua_State *L) {
+  msgpack_Reader *R = msgpack_reader_check(L);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, n >= 1, 2, "record number must be positive");
+  if (!R->data)
+    return 0;
+  lua_settop(L, 2);
+  lua_pushcfunction(L, msgpack_reader_seek_init);
+  lua_insert(L, 1);
+  if (LUA_OK == lua_pcall(L, 2, 1, 0))
+    return 1;
+  lua_pushboolean(L, 0);
+  lua_insert(L, -2);
+  return 2;
+}
+
+/* 下一条记录的序号(从`1`开始) */
+static int msgpack_reader_tell(lua_State *L) {
+  msgpack_Reader *R = msgpack_reader_check(L);
+  lua_pushinteger(L, R->idx + 1);
+  return 1;
+}
+
+/* 解除映射, 之后的读取都会返回`nil`. */
+static int msgpack_reader_close(lua_State *L) {
+  msgpack_Reader *R = msgpack_reader_check(L);
+  if (R->data)
+    munmap((void*)R->data, R->size);
+  if (R->offsets)
+    xrio_free(R->offsets);
+  R->data = NULL; R->size = R->pos = R->idx = 0;
+  R->offsets = NULL; R->indexed = R->cap = 0;
+  return 0;
+}
+
+/* 打开记录文件: msgpack.open(path [, { key_cache = true }]), 失败时返回`nil`与错误信息. */
+int lmsgpack_open(lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  int key_cache = 0;
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "key_cache");
+    key_cache = lua_toboolean(L, -1); lua_pop(L, 1);
+  }
+  msgpack_Reader *R = lua_newuserdata(L, sizeof(msgpack_Reader));
+  memset(R, 0, sizeof(msgpack_Reader));
+  R->key_cache = key_cache;
+  luaL_setmetatable(L, "lua_Reader");
+  if (key_cache) {
+    msgpack_keycache_init(L, &R->K);
+    lua_setuservalue(L, -2);
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", path, strerror(errno));
+    return 2;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int err = errno; close(fd);
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", path, strerror(err));
+    return 2;
+  }
+  if (st.st_size <= 0) {
+    close(fd);
+    return 1;
+  }
+  /* 映射建立后就不再需要`fd`, 在任何可能抛出异常的调用之前关闭; 映射由`__gc`负责解除. */
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int err = errno; close(fd);
+  if (data == MAP_FAILED) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", path, strerror(err));
+    return 2;
+  }
+  R->data = data; R->size = (size_t)st.st_size;
+#if defined(MADV_SEQUENTIAL)
+  madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+  msgpack_reader_push(L, R, 0);
+  return 1;
+}
+
+void msgpack_reader_meta(lua_State *L) {
+  luaL_Reg reader_libs[] = {
+    {"next", msgpack_reader_next},
+    {"records", msgpack_reader_records},
+    {"count", msgpack_reader_count},
+    {"seek", msgpack_reader_seek},
+    {"tell", msgpack_reader_tell},
+    {"close", msgpack_reader_close},
+    {NULL, NULL}
+  };
+  luaL_newmetatable(L, "lua_Reader");
+  luaL_newlib(L, reader_libs);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, msgpack_reader_close);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
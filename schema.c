@@ -0,0 +1,206 @@
+#include "msgpack.h"
+
+/*
+  预编译的固定结构记录: 字段集合在创建时就已确定, 所以`Map`头部与每个`key`的编码结果都可以预先生成.
+  编码时按字段顺序直接读取对应的值, 不再需要`lua_next`遍历; 解码时按位置比较`key`的编码结果,
+  只要与预期的结构不一致就会退回到通用的`msgpack_dec_map`.
+*/
+typedef struct msgpack_Schema {
+  int count;          /* 字段数量 */
+  size_t *offsets;    /* 第`i`个`key`的编码结果位于[offsets[i], offsets[i + 1]), offsets[0]为头部长度 */
+  char *data;         /* 头部 + 所有`key`的编码结果 */
+} msgpack_Schema;
+
+#define msgpack_schema_check(L) ((msgpack_Schema*)luaL_checkudata(L, 1, "lua_Schema"))
+
+static int msgpack_schema_encode_init(lua_State *L) {
+  xrio_Buffer *B = lua_touserdata(L, 1);
+  msgpack_Schema *S = lua_touserdata(L, 2);
+  msgpack_Encoder E;
+  msgpack_encoder_init(L, &E);
+  lua_getuservalue(L, 2);
+  int names = lua_gettop(L);
+
+  xrio_addlstring(B, S->data, S->offsets[0]);
+  for (int i = 0; i < S->count; i++)
+  {
+    xrio_addlstring(B, S->data + S->offsets[i], S->offsets[i + 1] - S->offsets[i]);
+    lua_rawgeti(L, names, i + 1);
+    lua_rawget(L, 3);
+    msgpack_enc_value(L, &E, B, 1, "schema");
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
+/* 编码: schema:encode(table), 出错时释放缓冲区后重新抛出错误 */
+static int msgpack_schema_encode(lua_State *L) {
+  msgpack_schema_check(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 2);
+
+  xrio_Buffer B;
+  xrio_buffinit(L, &B);
+  lua_pushcfunction(L, msgpack_schema_encode_init);
+  lua_pushlightuserdata(L, &B);
+  lua_pushvalue(L, 1);
+  lua_pushvalue(L, 2);
+  if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
+    B.L = NULL; xrio_pushresult(&B);
+    return lua_error(L);
+  }
+  msgpack_stats_message(1, xrio_buffgetidx((&B)));
+  xrio_pushresult(&B);
+  return 1;
+}
+
+static int msgpack_schema_decode_init(lua_State *L) {
+  msgpack_Schema *S = lua_touserdata(L, 1);
+  size_t bsize;
+  const char *buffer = luaL_checklstring(L, 2, &bsize);
+  if (!buffer || bsize < 1)
+    return luaL_error(L, "[msgpack error]: decode buffer was empty");
+  size_t offset = msgpack_decode_pos(L, 3, bsize);
+  buffer += offset; bsize -= offset;
+
+  msgpack_Decoder D = { .keys = NULL };
+  lua_getuservalue(L, 1);
+  int names = lua_gettop(L);
+
+  size_t pos = S->offsets[0];
+  if (bsize >= pos && !memcmp(buffer, S->data, pos))
+  {
+    lua_createtable(L, 0, S->count);
+    for (int i = 0; i < S->count; i++)
+    {
+      size_t klen = S->offsets[i + 1] - S->offsets[i];
+      if (bsize - pos < klen || memcmp(buffer + pos, S->data + S->offsets[i], klen))
+        break;
+      pos += klen;
+      lua_rawgeti(L, names, i + 1);
+      pos += msgpack_dec_value(L, &D, 1, buffer + pos, bsize - pos);
+      lua_rawset(L, -3);
+      if (i + 1 == S->count) {
+        lua_pushinteger(L, offset + pos + 1);
+        return 2;
+      }
+    }
+    lua_settop(L, names);
+  }
+  /* 与预期结构不一致, 使用通用的解码方式. */
+  pos = msgpack_dec_map(L, &D, 1, buffer, bsize);
+  lua_pushinteger(L, offset + pos + 1);
+  return 2;
+}
+
+/* 解码: schema:decode(buffer [, pos]) */
+static int msgpack_schema_decode(lua_State *L) {
+  msgpack_schema_check(L);
+  luaL_checkstring(L, 2);
+  lua_settop(L, 3);
+  /* 使用保护模式调用 */
+  lua_pushcfunction(L, msgpack_schema_decode_init);
+  lua_insert(L, 1);
+  if (LUA_OK == lua_pcall(L, 3, 2, 0))
+    return 2;
+  lua_pushboolean(L, 0);
+  lua_pushvalue(L, -2);
+  return 2;
+}
+
+static int msgpack_schema_init(lua_State *L) {
+  xrio_Buffer *B = lua_touserdata(L, 1);
+  msgpack_Schema *S = lua_touserdata(L, 2);
+  int count = S->count;
+  msgpack_enc_length(L, B, count, 0x80, MSG_TYPE_MAP16, MSG_TYPE_MAP32);
+  for (int i = 0; i < count; i++)
+  {
+    size_t bsize; const char *buffer;
+    lua_rawgeti(L, 3, i + 1);
+    buffer = lua_tolstring(L, -1, &bsize);
+    S->offsets[i] = xrio_buffgetidx(B);
+    msgpack_enc_string(L, B, buffer, bsize);
+    lua_pop(L, 1);
+  }
+  S->offsets[count] = xrio_buffgetidx(B);
+  return 0;
+}
+
+/* 创建: msgpack.schema { "id", "ts", "user", "tags" } */
+int lmsgpack_schema(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+  int count = (int)lua_rawlen(L, 1);
+  if (count < 1)
+    return luaL_error(L, "[msgpack error]: schema need at least one field.");
+
+  /* 字段名保存在`uservalue`中, 编码与解码时按位置直接获取; 重复的字段名无法被正确解码. */
+  lua_createtable(L, count, 0);
+  lua_createtable(L, 0, count);
+  for (int i = 1; i <= count; i++)
+  {
+    if (lua_rawgeti(L, 1, i) != LUA_TSTRING)
+      return luaL_error(L, "[msgpack error]: schema field `%d` must be a string.", i);
+    lua_pushvalue(L, -1);
+    if (lua_rawget(L, 3) != LUA_TNIL)
+      return luaL_error(L, "[msgpack error]: schema field `%s` is duplicated.", lua_tostring(L, -2));
+    lua_pop(L, 1);
+    lua_pushvalue(L, -1);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, 3);
+    lua_rawseti(L, 2, i);
+  }
+  lua_settop(L, 2);
+
+  /* 先创建`userdata`, 之后分配的内存都由`__gc`负责释放. */
+  msgpack_Schema *S = lua_newuserdata(L, sizeof(msgpack_Schema));
+  S->count = 0; S->offsets = NULL; S->data = NULL;
+  luaL_setmetatable(L, "lua_Schema");
+  if (!(S->offsets = xrio_malloc(sizeof(size_t) * (count + 1))))
+    return luaL_error(L, "[msgpack error]: schema out of memory.");
+  S->count = count;
+
+  xrio_Buffer B;
+  xrio_buffinit(L, &B);
+  lua_pushcfunction(L, msgpack_schema_init);
+  lua_pushlightuserdata(L, &B);
+  lua_pushvalue(L, 3);
+  lua_pushvalue(L, 2);
+  if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
+    B.L = NULL; xrio_pushresult(&B);
+    return lua_error(L);
+  }
+  S->data = xrio_malloc(S->offsets[count]);
+  if (S->data)
+    memcpy(S->data, B.b, S->offsets[count]);
+  B.L = NULL; xrio_pushresult(&B);
+  if (!S->data)
+    return luaL_error(L, "[msgpack error]: schema out of memory.");
+  lua_pushvalue(L, 2);
+  lua_setuservalue(L, 3);
+  return 1;
+}
+
+static int msgpack_schema_gc(lua_State *L) {
+  msgpack_Schema *S = msgpack_schema_check(L);
+  if (S->offsets)
+    xrio_free(S->offsets);
+  if (S->data)
+    xrio_free(S->data);
+  S->offsets = NULL; S->data = NULL; S->count = 0;
+  return 0;
+}
+
+void msgpack_schema_meta(lua_State *L) {
+  luaL_Reg schema_libs[] = {
+    {"encode", msgpack_schema_encode},
+    {"decode", msgpack_schema_decode},
+    {NULL, NULL}
+  };
+  luaL_newmetatable(L, "lua_Schema");
+  luaL_newlib(L, schema_libs);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, msgpack_schema_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
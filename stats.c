@@ -0,0 +1,85 @@
+#include "msgpack.h"
+
+#if !defined(USE_MSGPACK_NO_STATS)
+
+msgpack_Stats msgpack_stats;
+
+/* 记录一次完整的编码或解码(顶层值) */
+void msgpack_stats_message(int encode, size_t size) {
+  int i = 0;
+  while (i < MSGPACK_STATS_BUCKETS - 1 && size >= ((size_t)64 << (2 * i)))
+    i++;
+  msgpack_stats_add(sizes[i], 1);
+  if (encode) {
+    msgpack_stats_add(encode_calls, 1); msgpack_stats_add(bytes_out, size);
+  } else {
+    msgpack_stats_add(decode_calls, 1); msgpack_stats_add(bytes_in, size);
+  }
+}
+
+#define msgpack_stats_load(v)             ((lua_Integer)__atomic_load_n(&(v), __ATOMIC_RELAXED))
+#define msgpack_stats_field(L, S, name)   (lua_pushinteger(L, msgpack_stats_load((S)->name)), lua_setfield(L, -2, #name))
+
+/*
+  获取统计信息: msgpack.stats()
+  `sizes`以区间上限(字节)为`key`, 最后一个区间的`key`为`math.huge`; 编译时移除统计后返回`nil`.
+*/
+int lmsgpack_stats(lua_State *L) {
+  static const char *const errors[MSGPACK_STATS_ERRORS] = { "truncated", "format", "depth", "limit", "encode" };
+  msgpack_Stats *S = &msgpack_stats;
+  lua_createtable(L, 0, 12);
+  msgpack_stats_field(L, S, encode_calls);
+  msgpack_stats_field(L, S, bytes_out);
+  msgpack_stats_field(L, S, decode_calls);
+  msgpack_stats_field(L, S, bytes_in);
+  msgpack_stats_field(L, S, tables);
+  msgpack_stats_field(L, S, max_depth);
+  msgpack_stats_field(L, S, spills);
+  msgpack_stats_field(L, S, realloc_bytes);
+  msgpack_stats_field(L, S, array_fallbacks);
+
+  lua_createtable(L, 0, MSGPACK_STATS_ERRORS);
+  for (int i = 0; i < MSGPACK_STATS_ERRORS; i++)
+  {
+    lua_pushinteger(L, msgpack_stats_load(S->errors[i]));
+    lua_setfield(L, -2, errors[i]);
+  }
+  lua_setfield(L, -2, "errors");
+
+  lua_createtable(L, 0, MSGPACK_STATS_BUCKETS);
+  for (int i = 0; i < MSGPACK_STATS_BUCKETS; i++)
+  {
+    if (i < MSGPACK_STATS_BUCKETS - 1)
+      lua_pushinteger(L, (lua_Integer)64 << (2 * i));
+    else
+      lua_pushnumber(L, HUGE_VAL);
+    lua_pushinteger(L, msgpack_stats_load(S->sizes[i]));
+    lua_rawset(L, -3);
+  }
+  lua_setfield(L, -2, "sizes");
+  return 1;
+}
+
+/* 清空统计信息: msgpack.stats_reset() */
+int lmsgpack_stats_reset(lua_State *L) {
+  (void)L;
+  /* 所有字段都是`uint64_t`, 逐个清零以免与其它线程的计数发生数据竞争 */
+  uint64_t *field = (uint64_t*)&msgpack_stats;
+  for (size_t i = 0; i < sizeof(msgpack_Stats) / sizeof(uint64_t); i++)
+    __atomic_store_n(&field[i], 0, __ATOMIC_RELAXED);
+  return 0;
+}
+
+#else
+
+int lmsgpack_stats(lua_State *L) {
+  (void)L;
+  return 0;
+}
+
+int lmsgpack_stats_reset(lua_State *L) {
+  (void)L;
+  return 0;
+}
+
+#endif
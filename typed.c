@@ -0,0 +1,426 @@
+#include "msgpack.h"
+#include <limits.h>
+
+/*
+  数值数组的紧凑表示: 元素类型一致的数值`Array`可以直接解码为连续存储的`int64`/`double`,
+  每个元素只占`8`字节, 也不需要逐个`lua_rawseti`. 元素全部为整数时使用`int64`, 否则使用`double`.
+  `msgpack`的数组元素之间带有类型字节, 内容并不连续, 所以无法整块交换字节序;
+  元素类型完全相同时(最常见的情况)会使用没有分支的专用循环, 否则逐个元素按类型转换.
+*/
+
+#define msgpack_typed_check(L, idx) ((msgpack_Typed*)luaL_checkudata(L, idx, "lua_Typed"))
+
+/* 创建指定类型与长度的数组并压入栈顶 */
+msgpack_Typed* msgpack_typed_new(lua_State *L, int type, size_t count) {
+  if (count > (SIZE_MAX - sizeof(msgpack_Typed)) / 8)
+    luaL_error(L, "[msgpack error]: typed array was too long(%zu).", count);
+  msgpack_Typed *T = lua_newuserdata(L, sizeof(msgpack_Typed) + count * 8);
+  T->count = count; T->type = type;
+  luaL_setmetatable(L, "lua_Typed");
+  return T;
+}
+
+/* 统一元素类型的专用循环: 每个元素为`1`字节类型 + `w`字节内容 */
+#define msgpack_typed_loop(out, load, cast, w) \
+  for (size_t i = 0; i < count; i++) \
+    out[i] = (cast)load(buffer + i * (w + 1) + 1);
+
+static inline uint8_t msgpack_typed_u8(const char *buffer) { return *(const uint8_t*)buffer; }
+static inline int8_t msgpack_typed_i8(const char *buffer) { return *(const int8_t*)buffer; }
+
+static inline double msgpack_typed_f32(const char *buffer) {
+  xrio_u32_t v = { .i = xrio_load32(buffer) };
+  return v.n;
+}
+
+static inline double msgpack_typed_f64(const char *buffer) {
+  xrio_u64_t v = { .i = xrio_load64(buffer) };
+  return v.n;
+}
+
+/* 读取`buffer`处的一个数值 */
+static inline void msgpack_typed_load(const char *buffer, uint8_t op, int64_t *i, double *n) {
+  switch (op)
+  {
+    case MSGPACK_OP_POSFIX:  *i = *(const uint8_t*)buffer; return;
+    case MSGPACK_OP_NEGFIX:  *i = *(const int8_t*)buffer; return;
+    case MSGPACK_OP_UINT8:   *i = msgpack_typed_u8(buffer + 1); return;
+    case MSGPACK_OP_UINT16:  *i = xrio_load16(buffer + 1); return;
+    case MSGPACK_OP_UINT32:  *i = xrio_load32(buffer + 1); return;
+    case MSGPACK_OP_UINT64:  *i = (int64_t)xrio_load64(buffer + 1); return;
+    case MSGPACK_OP_INT8:    *i = msgpack_typed_i8(buffer + 1); return;
+    case MSGPACK_OP_INT16:   *i = (int16_t)xrio_load16(buffer + 1); return;
+    case MSGPACK_OP_INT32:   *i = (int32_t)xrio_load32(buffer + 1); return;
+    case MSGPACK_OP_INT64:   *i = (int64_t)xrio_load64(buffer + 1); return;
+    case MSGPACK_OP_FLOAT32: *n = msgpack_typed_f32(buffer + 1); return;
+    default:                 *n = msgpack_typed_f64(buffer + 1); return;
+  }
+}
+
+/*
+  尝试将`buffer`处的`count`个元素解码为数值数组(`buffer`指向第一个元素),
+  成功时压入栈顶并返回消耗的字节数; 元素中存在非数值类型或数据不完整时返回`0`, 交由通用路径处理.
+*/
+size_t msgpack_dec_typed(lua_State *L, const char *buffer, size_t bsize, size_t count) {
+  /* 第一遍: 检查元素类型与边界 */
+  size_t pos = 0; int floating = 0; uint8_t first = *(const uint8_t*)buffer; int uniform = 1;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (pos >= bsize)
+      return 0;
+    uint8_t t = *(const uint8_t*)(buffer + pos);
+    const msgpack_Lead *d = &msgpack_leads[t];
+    if (d->op > MSGPACK_OP_INT64 || d->op < MSGPACK_OP_FLOAT32) {
+      if (d->op != MSGPACK_OP_POSFIX && d->op != MSGPACK_OP_NEGFIX)
+        return 0;
+    }
+    floating |= d->op == MSGPACK_OP_FLOAT32 || d->op == MSGPACK_OP_FLOAT64;
+    uniform &= t == first;
+    pos += d->hlen + d->inl;
+  }
+  if (pos > bsize)
+    return 0;
+
+  /* 第二遍: 转换 */
+  msgpack_Typed *T = msgpack_typed_new(L, floating ? MSGPACK_TYPED_DOUBLE : MSGPACK_TYPED_INT64, count);
+  int64_t *ivec = msgpack_typed_int64(T); double *nvec = msgpack_typed_double(T);
+  if (uniform) {
+    switch (first)
+    {
+      case MSG_TYPE_FLOAT64: msgpack_typed_loop(nvec, msgpack_typed_f64, double, 8); goto check;
+      case MSG_TYPE_FLOAT32: msgpack_typed_loop(nvec, msgpack_typed_f32, double, 4); goto check;
+      case MSG_TYPE_INT64:   msgpack_typed_loop(ivec, xrio_load64, int64_t, 8); return pos;
+      case MSG_TYPE_INT32:   msgpack_typed_loop(ivec, xrio_load32, int32_t, 4); return pos;
+      case MSG_TYPE_INT16:   msgpack_typed_loop(ivec, xrio_load16, int16_t, 2); return pos;
+      case MSG_TYPE_INT8:    msgpack_typed_loop(ivec, msgpack_typed_i8, int8_t, 1); return pos;
+      case MSG_TYPE_UINT64:  msgpack_typed_loop(ivec, xrio_load64, int64_t, 8); return pos;
+      case MSG_TYPE_UINT32:  msgpack_typed_loop(ivec, xrio_load32, uint32_t, 4); return pos;
+      case MSG_TYPE_UINT16:  msgpack_typed_loop(ivec, xrio_load16, uint16_t, 2); return pos;
+      case MSG_TYPE_UINT8:   msgpack_typed_loop(ivec, msgpack_typed_u8, uint8_t, 1); return pos;
+    }
+  }
+  const char *p = buffer;
+  for (size_t i = 0; i < count; i++)
+  {
+    const msgpack_Lead *d = &msgpack_leads[*(const uint8_t*)p];
+    int64_t iv = 0; double nv = 0;
+    msgpack_typed_load(p, d->op, &iv, &nv);
+    if (floating)
+      nvec[i] = d->op == MSGPACK_OP_FLOAT32 || d->op == MSGPACK_OP_FLOAT64 ? nv : (double)iv;
+    else
+      ivec[i] = iv;
+    p += d->hlen + d->inl;
+  }
+  if (!floating)
+    return pos;
+
+check:
+  /* 与通用路径一致: 不接受`INF`或`NaN` */
+  for (size_t i = 0; i < count; i++)
+    if (isnan(nvec[i]) || isinf(nvec[i]))
+      return luaL_error(L, "[msgpack decode]: `msgpack_dec_float` has got `INF` or `NaN` key.");
+  return pos;
+}
+
+/* 编码`lua_Typed`: 与普通数组相同, 每个元素使用最短的编码格式, 但不需要逐个从表中取值. */
+void msgpack_enc_typed(lua_State *L, xrio_Buffer *B, int idx) {
+  msgpack_Typed *T = lua_touserdata(L, idx);
+  msgpack_enc_length(L, B, T->count, 0x90, MSG_TYPE_ARR16, MSG_TYPE_ARR32);
+  if (T->type == MSGPACK_TYPED_INT64) {
+    const int64_t *ivec = msgpack_typed_int64(T);
+    for (size_t i = 0; i < T->count; i++)
+      msgpack_enc_integer(B, ivec[i]);
+  } else {
+    const double *nvec = msgpack_typed_double(T);
+    for (size_t i = 0; i < T->count; i++)
+      msgpack_enc_number(B, nvec[i]);
+  }
+}
+
+/*
+  数值向量(`lua_Vector`): 引用一段连续的数值(字符串或`lua_Typed`), 编码为元素类型完全一致的`Array`.
+  所有元素的长度相同, 所以整个数组只需要预留一次空间, 然后由没有分支的循环逐个写入类型字节与大端内容.
+*/
+#define MSGPACK_VECTOR_STRING (-1)  /* 来源为本机字节序的`string.pack`字符串 */
+
+typedef struct msgpack_Vector {
+  const char *data;   /* 数据的起始地址(来源被锚定在`uservalue`中) */
+  size_t count;
+  int type;           /* `msgpack_vector_types`的下标 */
+  int source;         /* `MSGPACK_VECTOR_STRING`或`MSGPACK_TYPED_*` */
+} msgpack_Vector;
+
+enum { MSGPACK_VEC_INT8, MSGPACK_VEC_INT16, MSGPACK_VEC_INT32, MSGPACK_VEC_INT64,
+       MSGPACK_VEC_UINT8, MSGPACK_VEC_UINT16, MSGPACK_VEC_UINT32, MSGPACK_VEC_UINT64,
+       MSGPACK_VEC_FLOAT32, MSGPACK_VEC_FLOAT64 };
+
+static const char *const msgpack_vector_names[] = {
+  "int8", "int16", "int32", "int64", "uint8", "uint16", "uint32", "uint64", "float32", "float64", NULL
+};
+
+static const struct { uint8_t tag; uint8_t width; } msgpack_vector_types[] = {
+  { MSG_TYPE_INT8, 1 }, { MSG_TYPE_INT16, 2 }, { MSG_TYPE_INT32, 4 }, { MSG_TYPE_INT64, 8 },
+  { MSG_TYPE_UINT8, 1 }, { MSG_TYPE_UINT16, 2 }, { MSG_TYPE_UINT32, 4 }, { MSG_TYPE_UINT64, 8 },
+  { MSG_TYPE_FLOAT32, 4 }, { MSG_TYPE_FLOAT64, 8 },
+};
+
+static inline void msgpack_vector_f32(char *p, float n) {
+  xrio_u32_t v = { .n = n };
+  xrio_store32(p, (uint32_t)v.i);
+}
+
+static inline void msgpack_vector_f64(char *p, double n) {
+  xrio_u64_t v = { .n = n };
+  xrio_store64(p, (uint64_t)v.i);
+}
+
+#define msgpack_vector_s8(p, v)   (*(p) = (char)(v))
+#define msgpack_vector_s16(p, v)  xrio_store16((p), (uint16_t)(v))
+#define msgpack_vector_s32(p, v)  xrio_store32((p), (uint32_t)(v))
+#define msgpack_vector_s64(p, v)  xrio_store64((p), (uint64_t)(v))
+
+/* 每个元素为`1`字节类型 + `sizeof(ctype)`字节大端内容 */
+#define msgpack_vector_loop(ctype, store, load) \
+  for (size_t i = done; i < done + n; i++, p += sizeof(ctype) + 1) { \
+    ctype v = load; p[0] = (char)tag; store(p + 1, v); \
+  }
+
+#define msgpack_vector_case(T, ctype, store) \
+  case T: \
+    if (V->source == MSGPACK_VECTOR_STRING) \
+      msgpack_vector_loop(ctype, store, ({ctype n; memcpy(&n, V->data + i * sizeof(ctype), sizeof(ctype)); n;})) \
+    else if (V->source == MSGPACK_TYPED_INT64) \
+      msgpack_vector_loop(ctype, store, (ctype)((const int64_t*)V->data)[i]) \
+    else \
+      msgpack_vector_loop(ctype, store, (ctype)((const double*)V->data)[i]) \
+    break;
+
+/* `int64`数组写入更窄的整数类型时检查范围(数组在创建向量之后仍然可以被修改) */
+#define msgpack_vector_range(T, ctype, cond) \
+  case T: \
+    for (size_t i = 0; i < V->count; i++) \
+      if (!(cond)) \
+        luaL_error(L, "[msgpack encode]: vector element `%I` was out of %s range.", (lua_Integer)ivec[i], msgpack_vector_names[T]); \
+    break;
+
+static void msgpack_vector_check(lua_State *L, msgpack_Vector *V) {
+  const int64_t *ivec = (const int64_t*)V->data;
+  switch (V->type)
+  {
+    msgpack_vector_range(MSGPACK_VEC_INT8, int8_t, ivec[i] == (int8_t)ivec[i])
+    msgpack_vector_range(MSGPACK_VEC_INT16, int16_t, ivec[i] == (int16_t)ivec[i])
+    msgpack_vector_range(MSGPACK_VEC_INT32, int32_t, ivec[i] == (int32_t)ivec[i])
+    msgpack_vector_range(MSGPACK_VEC_UINT8, uint8_t, ivec[i] == (uint8_t)ivec[i])
+    msgpack_vector_range(MSGPACK_VEC_UINT16, uint16_t, ivec[i] == (uint16_t)ivec[i])
+    msgpack_vector_range(MSGPACK_VEC_UINT32, uint32_t, ivec[i] == (uint32_t)ivec[i])
+    msgpack_vector_range(MSGPACK_VEC_UINT64, uint64_t, ivec[i] >= 0)
+    default:
+      break;
+  }
+}
+
+#define msgpack_vector_load(ctype) \
+  (V->source == MSGPACK_VECTOR_STRING ? ({ctype n; memcpy(&n, V->data + i * sizeof(ctype), sizeof(ctype)); n;}) : \
+   V->source == MSGPACK_TYPED_INT64 ? (ctype)((const int64_t*)V->data)[i] : (ctype)((const double*)V->data)[i])
+
+/* 规范编码: 与普通数组相同, 每个元素使用最短的编码格式. */
+static void msgpack_vector_shortest(xrio_Buffer *B, msgpack_Vector *V) {
+  for (size_t i = 0; i < V->count; i++)
+  {
+    switch (V->type)
+    {
+      case MSGPACK_VEC_INT8: msgpack_enc_integer(B, msgpack_vector_load(int8_t)); break;
+      case MSGPACK_VEC_INT16: msgpack_enc_integer(B, msgpack_vector_load(int16_t)); break;
+      case MSGPACK_VEC_INT32: msgpack_enc_integer(B, msgpack_vector_load(int32_t)); break;
+      case MSGPACK_VEC_INT64: msgpack_enc_integer(B, msgpack_vector_load(int64_t)); break;
+      case MSGPACK_VEC_UINT8: msgpack_enc_integer(B, msgpack_vector_load(uint8_t)); break;
+      case MSGPACK_VEC_UINT16: msgpack_enc_integer(B, msgpack_vector_load(uint16_t)); break;
+      case MSGPACK_VEC_UINT32: msgpack_enc_integer(B, msgpack_vector_load(uint32_t)); break;
+      case MSGPACK_VEC_UINT64:
+        {
+          uint64_t v = msgpack_vector_load(uint64_t);
+          if (v <= INT64_MAX) {
+            msgpack_enc_integer(B, (lua_Integer)v);
+            break;
+          }
+          /* 超出`int64`范围的值只能使用`uint64` */
+          char *p = xrio_reserve(B, 9);
+          p[0] = (char)MSG_TYPE_UINT64; xrio_store64(p + 1, v);
+        }
+        break;
+      case MSGPACK_VEC_FLOAT32: msgpack_enc_number(B, msgpack_vector_load(float)); break;
+      case MSGPACK_VEC_FLOAT64: msgpack_enc_number(B, msgpack_vector_load(double)); break;
+    }
+  }
+}
+
+/* 编码`lua_Vector`, `canonical`不为`0`时每个元素使用最短的编码格式 */
+void msgpack_enc_vector(lua_State *L, xrio_Buffer *B, int idx, int canonical) {
+  msgpack_Vector *V = lua_touserdata(L, idx);
+  if (V->source == MSGPACK_TYPED_INT64)
+    msgpack_vector_check(L, V);
+  uint8_t tag = msgpack_vector_types[V->type].tag; size_t width = msgpack_vector_types[V->type].width;
+  msgpack_enc_length(L, B, V->count, 0x90, MSG_TYPE_ARR16, MSG_TYPE_ARR32);
+  if (canonical) {
+    msgpack_vector_shortest(B, V);
+    return;
+  }
+  /* 直接写出的缓冲区只能分段填充 */
+  size_t chunk = B->write ? (xrio_buffer_size - 1) / (width + 1) : V->count;
+  for (size_t done = 0, n; done < V->count; done += n)
+  {
+    n = V->count - done < chunk ? V->count - done : chunk;
+    char *p = xrio_reserve(B, n * (width + 1));
+    switch (V->type)
+    {
+      msgpack_vector_case(MSGPACK_VEC_INT8, int8_t, msgpack_vector_s8)
+      msgpack_vector_case(MSGPACK_VEC_INT16, int16_t, msgpack_vector_s16)
+      msgpack_vector_case(MSGPACK_VEC_INT32, int32_t, msgpack_vector_s32)
+      msgpack_vector_case(MSGPACK_VEC_INT64, int64_t, msgpack_vector_s64)
+      msgpack_vector_case(MSGPACK_VEC_UINT8, uint8_t, msgpack_vector_s8)
+      msgpack_vector_case(MSGPACK_VEC_UINT16, uint16_t, msgpack_vector_s16)
+      msgpack_vector_case(MSGPACK_VEC_UINT32, uint32_t, msgpack_vector_s32)
+      msgpack_vector_case(MSGPACK_VEC_UINT64, uint64_t, msgpack_vector_s64)
+      msgpack_vector_case(MSGPACK_VEC_FLOAT32, float, msgpack_vector_f32)
+      msgpack_vector_case(MSGPACK_VEC_FLOAT64, double, msgpack_vector_f64)
+    }
+  }
+}
+
+/*
+  创建数值向量: msgpack.vector(source, type)
+    source 为字符串时按本机字节序保存`type`类型的数值(例如`string.pack("=" .. ("f"):rep(n), ...)`);
+    source 为`lua_Typed`时按`type`转换, `double`数组只能写入浮点类型.
+*/
+int lmsgpack_vector(lua_State *L) {
+  int type = luaL_checkoption(L, 2, NULL, msgpack_vector_names);
+  size_t width = msgpack_vector_types[type].width;
+  const char *data; size_t count; int source;
+  if (lua_type(L, 1) == LUA_TSTRING) {
+    size_t bsize; data = lua_tolstring(L, 1, &bsize);
+    luaL_argcheck(L, bsize % width == 0, 1, "string length is not a multiple of the element size");
+    count = bsize / width; source = MSGPACK_VECTOR_STRING;
+  } else {
+    msgpack_Typed *T = msgpack_typed_check(L, 1);
+    luaL_argcheck(L, T->type == MSGPACK_TYPED_INT64 || type >= MSGPACK_VEC_FLOAT32, 2, "double array requires a float type");
+    data = (const char*)(T + 1); count = T->count; source = T->type;
+  }
+  msgpack_Vector *V = lua_newuserdata(L, sizeof(msgpack_Vector));
+  V->data = data; V->count = count; V->type = type; V->source = source;
+  lua_pushvalue(L, 1);
+  lua_setuservalue(L, -2);
+  luaL_setmetatable(L, "lua_Vector");
+  return 1;
+}
+
+static int msgpack_vector_len(lua_State *L) {
+  msgpack_Vector *V = luaL_checkudata(L, 1, "lua_Vector");
+  lua_pushinteger(L, V->count);
+  return 1;
+}
+
+/* 取出第`idx`个元素(从`1`开始) */
+static int msgpack_typed_index(lua_State *L) {
+  msgpack_Typed *T = msgpack_typed_check(L, 1);
+  if (lua_type(L, 2) != LUA_TNUMBER) {
+    /* 方法(数字字符串不会被当作下标) */
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+    return 1;
+  }
+  int isnum; lua_Integer idx = lua_tointegerx(L, 2, &isnum);
+  if (!isnum || idx < 1 || (size_t)idx > T->count)
+    return 0;
+  if (T->type == MSGPACK_TYPED_INT64)
+    lua_pushinteger(L, msgpack_typed_int64(T)[idx - 1]);
+  else
+    lua_pushnumber(L, msgpack_typed_double(T)[idx - 1]);
+  return 1;
+}
+
+/* 修改第`idx`个元素, 不能改变长度. */
+static int msgpack_typed_newindex(lua_State *L) {
+  msgpack_Typed *T = msgpack_typed_check(L, 1);
+  luaL_checktype(L, 2, LUA_TNUMBER);
+  lua_Integer idx = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, idx >= 1 && (size_t)idx <= T->count, 2, "index out of range");
+  if (T->type == MSGPACK_TYPED_INT64)
+    msgpack_typed_int64(T)[idx - 1] = luaL_checkinteger(L, 3);
+  else
+    msgpack_typed_double(T)[idx - 1] = luaL_checknumber(L, 3);
+  return 0;
+}
+
+static int msgpack_typed_len(lua_State *L) {
+  msgpack_Typed *T = msgpack_typed_check(L, 1);
+  lua_pushinteger(L, T->count);
+  return 1;
+}
+
+/* 元素类型: "int64"或"double" */
+static int msgpack_typed_type(lua_State *L) {
+  msgpack_Typed *T = msgpack_typed_check(L, 1);
+  lua_pushstring(L, T->type == MSGPACK_TYPED_INT64 ? "int64" : "double");
+  return 1;
+}
+
+/* 数据的起始地址(`lightuserdata`), 在数组被回收之前一直有效. */
+static int msgpack_typed_pointer(lua_State *L) {
+  msgpack_Typed *T = msgpack_typed_check(L, 1);
+  lua_pushlightuserdata(L, T + 1);
+  return 1;
+}
+
+/* 以本机字节序返回原始数据, 可以配合`string.unpack("<d")`等直接读取. */
+static int msgpack_typed_bytes(lua_State *L) {
+  msgpack_Typed *T = msgpack_typed_check(L, 1);
+  lua_pushlstring(L, (const char*)(T + 1), T->count * 8);
+  return 1;
+}
+
+/* 转换为普通的`Lua`表 */
+static int msgpack_typed_totable(lua_State *L) {
+  msgpack_Typed *T = msgpack_typed_check(L, 1);
+  if (T->count > INT_MAX)
+    return luaL_error(L, "[msgpack error]: typed array was too long(%zu).", T->count);
+  lua_createtable(L, (int)T->count, 0);
+  for (size_t i = 0; i < T->count; i++)
+  {
+    if (T->type == MSGPACK_TYPED_INT64)
+      lua_pushinteger(L, msgpack_typed_int64(T)[i]);
+    else
+      lua_pushnumber(L, msgpack_typed_double(T)[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  luaL_setmetatable(L, "lua_List");
+  return 1;
+}
+
+void msgpack_typed_meta(lua_State *L) {
+  luaL_Reg typed_libs[] = {
+    {"type", msgpack_typed_type},
+    {"pointer", msgpack_typed_pointer},
+    {"bytes", msgpack_typed_bytes},
+    {"totable", msgpack_typed_totable},
+    {NULL, NULL}
+  };
+  luaL_newmetatable(L, "lua_Typed");
+  luaL_newlib(L, typed_libs);
+  lua_pushcclosure(L, msgpack_typed_index, 1);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, msgpack_typed_newindex);
+  lua_setfield(L, -2, "__newindex");
+  lua_pushcfunction(L, msgpack_typed_len);
+  lua_setfield(L, -2, "__len");
+
+  luaL_newmetatable(L, "lua_Vector");
+  lua_pushcfunction(L, msgpack_vector_len);
+  lua_setfield(L, -2, "__len");
+
+  /* 编码时通过元表地址识别 */
+  lua_getfield(L, LUA_REGISTRYINDEX, "lua_ExtRegistry");
+  msgpack_ExtRegistry *R = lua_touserdata(L, -1);
+  R->typed = lua_topointer(L, -3);
+  R->vector = lua_topointer(L, -2);
+  lua_pop(L, 3);
+}
@@ -0,0 +1,150 @@
+#include "msgpack.h"
+
+/*
+  流式解码器: 可以分多次`feed`任意大小的数据块, 每当缓冲区内出现一个完整的顶层值时`next`即可取出.
+  边界扫描的状态在多次`feed`之间保留, 不完整的消息既不会被重复扫描, 也不会被提前构建为`Lua`值.
+*/
+typedef struct msgpack_Unpacker {
+  char *b;
+  size_t rpos;  /* 当前消息的起始位置(之前的字节都已被消费) */
+  size_t wpos;  /* 已写入数据的结束位置 */
+  size_t blen;
+  msgpack_Scanner S;
+  int key_cache;      /* 是否启用`key`缓存(在多条消息之间共享) */
+  msgpack_KeyCache K;
+  msgpack_Decoder limits;   /* 资源限制, 对每条消息单独计算 */
+} msgpack_Unpacker;
+
+#define msgpack_unpacker_check(L) ((msgpack_Unpacker*)luaL_checkudata(L, 1, "lua_Unpacker"))
+
+static int msgpack_unpacker_decode(lua_State *L) {
+  msgpack_Unpacker *U = lua_touserdata(L, 1);
+  const char *buffer = lua_touserdata(L, 2);
+  msgpack_Decoder D = U->limits;
+  if (U->key_cache) {
+    lua_getuservalue(L, 1);
+    U->K.anchor = lua_gettop(L);
+    D.keys = &U->K;
+  }
+  msgpack_dec_value(L, &D, 0, buffer, (size_t)lua_tointeger(L, 3));
+  return 1;
+}
+
+/* 追加数据: 只在空间不足时才把未消费的部分前移, 已消费的字节不会被复制. */
+static int msgpack_unpacker_feed(lua_State *L) {
+  msgpack_Unpacker *U = msgpack_unpacker_check(L);
+  size_t bsize; const char *buffer = luaL_checklstring(L, 2, &bsize);
+  if (U->rpos == U->wpos)
+    U->rpos = U->wpos = 0;
+  if (U->wpos + bsize > U->blen)
+  {
+    if (U->rpos > 0) {
+      memmove(U->b, U->b + U->rpos, U->wpos - U->rpos);
+      U->wpos -= U->rpos; U->rpos = 0;
+    }
+    if (U->wpos + bsize > U->blen) {
+      size_t blen = U->blen ? U->blen : xrio_buffer_size;
+      while (U->wpos + bsize > blen)
+        blen <<= 1;
+      char *b = xrio_realloc(U->b, blen);
+      if (!b)
+        return luaL_error(L, "[msgpack error]: unpacker out of memory.");
+      U->b = b; U->blen = blen;
+    }
+  }
+  memcpy(U->b + U->wpos, buffer, bsize);
+  U->wpos += bsize;
+  return 0;
+}
+
+/* 取出下一个完整的值, 数据不足时返回`nil`; 消息格式错误时返回`false`与错误信息. */
+static int msgpack_unpacker_next(lua_State *L) {
+  msgpack_Unpacker *U = msgpack_unpacker_check(L);
+  int ret = msgpack_scan(&U->S, U->b + U->rpos, U->wpos - U->rpos);
+  if (ret == MSGPACK_SCAN_AGAIN)
+    return 0;
+  if (ret != MSGPACK_SCAN_DONE) {
+    /* 数据流已经无法重新同步, 丢弃所有缓存. */
+    U->rpos = U->wpos = 0; msgpack_scan_init(&U->S);
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, msgpack_scan_strerror(ret));
+    return 2;
+  }
+  const char *buffer = U->b + U->rpos; size_t bsize = U->S.pos;
+  U->rpos += bsize; msgpack_scan_init(&U->S);
+  /* 使用保护模式调用 */
+  lua_pushcfunction(L, msgpack_unpacker_decode);
+  lua_pushvalue(L, 1);
+  lua_pushlightuserdata(L, (void*)buffer);
+  lua_pushinteger(L, bsize);
+  if (LUA_OK == lua_pcall(L, 3, 1, 0))
+    return 1;
+  lua_pushboolean(L, 0);
+  lua_insert(L, -2);
+  return 2;
+}
+
+/* 丢弃所有缓存的数据 */
+static int msgpack_unpacker_reset(lua_State *L) {
+  msgpack_Unpacker *U = msgpack_unpacker_check(L);
+  U->rpos = U->wpos = 0; msgpack_scan_init(&U->S);
+  return 0;
+}
+
+/* 尚未被消费的字节数 */
+static int msgpack_unpacker_len(lua_State *L) {
+  msgpack_Unpacker *U = msgpack_unpacker_check(L);
+  lua_pushinteger(L, U->wpos - U->rpos);
+  return 1;
+}
+
+static int msgpack_unpacker_gc(lua_State *L) {
+  msgpack_Unpacker *U = msgpack_unpacker_check(L);
+  if (U->b)
+    xrio_free(U->b);
+  U->b = NULL; U->rpos = U->wpos = U->blen = 0;
+  msgpack_scan_free(&U->S);
+  return 0;
+}
+
+/* 创建流式解码器: msgpack.unpacker([{ key_cache = true, max_depth = ?, max_elements = ?, max_string = ?, max_memory = ? }]) */
+int lmsgpack_unpacker(lua_State *L) {
+  int key_cache = 0;
+  msgpack_Decoder limits; memset(&limits, 0, sizeof(limits));
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_getfield(L, 1, "key_cache");
+    key_cache = lua_toboolean(L, -1); lua_pop(L, 1);
+    msgpack_decode_limits(L, 1, &limits);
+  }
+  msgpack_Unpacker *U = lua_newuserdata(L, sizeof(msgpack_Unpacker));
+  U->limits = limits;
+  U->b = NULL; U->rpos = U->wpos = U->blen = 0;
+  msgpack_scan_setup(&U->S);
+  U->S.max_depth = limits.max_depth; U->S.max_string = limits.max_string;
+  U->S.max_elements = limits.max_elements; U->S.max_memory = limits.max_memory;
+  U->key_cache = key_cache;
+  luaL_setmetatable(L, "lua_Unpacker");
+  if (key_cache) {
+    msgpack_keycache_init(L, &U->K);
+    lua_setuservalue(L, -2);
+  }
+  return 1;
+}
+
+void msgpack_unpacker_meta(lua_State *L) {
+  luaL_Reg unpacker_libs[] = {
+    {"feed", msgpack_unpacker_feed},
+    {"next", msgpack_unpacker_next},
+    {"reset", msgpack_unpacker_reset},
+    {NULL, NULL}
+  };
+  luaL_newmetatable(L, "lua_Unpacker");
+  luaL_newlib(L, unpacker_libs);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, msgpack_unpacker_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, msgpack_unpacker_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
@@ -0,0 +1,166 @@
+#include "msgpack.h"
+
+/*
+  延迟解码的只读视图: 视图只保存原始字符串(锚定在`uservalue`中)与容器的起始位置,
+  访问某个元素时才会跳过它之前的元素并解码该元素; 嵌套的容器同样以子视图的形式返回,
+  所以不会为未访问到的部分创建任何`Lua`表.
+*/
+typedef struct msgpack_View {
+  const char *data;   /* 容器的起始位置 */
+  size_t size;        /* 从`data`开始到原始字符串结束的字节数 */
+  uint8_t kind;       /* `Array`或`Map` */
+  size_t hlen;        /* 容器头部长度 */
+  uint64_t count;     /* 元素数量(`Map`为键值对数量) */
+} msgpack_View;
+
+#define msgpack_view_check(L, idx) ((msgpack_View*)luaL_checkudata(L, idx, "lua_View"))
+
+/* 跳过一个值, 数据不完整时抛出异常. */
+static inline size_t msgpack_view_skip(lua_State *L, const char *buffer, size_t bsize) {
+  size_t len = msgpack_skip(buffer, bsize);
+  if (!len)
+    return luaL_error(L, "[msgpack decode]: Insufficient remaining byte array or unknown byte type.");
+  return len;
+}
+
+/* 将`buffer`处的值压入栈顶: 容器返回子视图(共享`anchor`处的原始字符串), 其它类型直接解码. */
+static size_t msgpack_view_push(lua_State *L, int anchor, const char *buffer, size_t bsize) {
+  msgpack_Head H;
+  if (msgpack_scan_head(buffer, bsize, &H) != MSGPACK_SCAN_DONE)
+    return luaL_error(L, "[msgpack decode]: Insufficient remaining byte array or unknown byte type.");
+  if (H.kind == MSGPACK_KIND_SCALAR) {
+    msgpack_Decoder D = { .keys = NULL };
+    return msgpack_dec_value(L, &D, 1, buffer, bsize);
+  }
+  msgpack_View *V = lua_newuserdata(L, sizeof(msgpack_View));
+  V->data = buffer; V->size = bsize;
+  V->kind = H.kind; V->hlen = H.hlen; V->count = H.count;
+  luaL_setmetatable(L, "lua_View");
+  lua_pushvalue(L, anchor);
+  lua_setuservalue(L, -2);
+  return 0;
+}
+
+/* 比较`buffer`处编码的`key`与栈上`idx`处的`key`是否相等 */
+static inline int msgpack_view_keyeq(lua_State *L, int idx, int kt, const char *buffer, size_t bsize) {
+  msgpack_Head H;
+  if (msgpack_scan_head(buffer, bsize, &H) != MSGPACK_SCAN_DONE || H.kind != MSGPACK_KIND_SCALAR)
+    return 0;
+  if (kt == LUA_TSTRING) {
+    uint8_t t = H.type;
+    if (!((t >= 0xa0 && t <= 0xbf) || (t >= MSG_TYPE_STR8 && t <= MSG_TYPE_STR32) || (t >= MSG_TYPE_BIN8 && t <= MSG_TYPE_BIN32)))
+      return 0;
+    size_t len; const char *key = lua_tolstring(L, idx, &len);
+    return H.payload == len && bsize - H.hlen >= len && !memcmp(buffer + H.hlen, key, len);
+  }
+  if (kt == LUA_TNUMBER) {
+    uint8_t t = H.type;
+    if (!(t <= 0x7f || t >= 0xe0 || (t >= MSG_TYPE_FLOAT32 && t <= MSG_TYPE_INT64)))
+      return 0;
+    msgpack_Decoder D = { .keys = NULL };
+    msgpack_dec_value(L, &D, 1, buffer, bsize);
+    int eq = lua_rawequal(L, idx, -1); lua_pop(L, 1);
+    return eq;
+  }
+  return 0;
+}
+
+static int msgpack_view_index(lua_State *L) {
+  msgpack_View *V = msgpack_view_check(L, 1);
+  lua_getuservalue(L, 1);
+  int anchor = lua_gettop(L);
+  const char *buffer = V->data + V->hlen; size_t bsize = V->size - V->hlen;
+  if (V->kind == MSGPACK_KIND_ARRAY) {
+    int isnum; lua_Integer idx = lua_tointegerx(L, 2, &isnum);
+    if (!isnum || idx < 1 || (uint64_t)idx > V->count)
+      return 0;
+    while (--idx) {
+      size_t len = msgpack_view_skip(L, buffer, bsize);
+      buffer += len; bsize -= len;
+    }
+    msgpack_view_push(L, anchor, buffer, bsize);
+    return 1;
+  }
+  int kt = lua_type(L, 2);
+  for (uint64_t i = 0; i < V->count; i++)
+  {
+    int eq = msgpack_view_keyeq(L, 2, kt, buffer, bsize);
+    size_t len = msgpack_view_skip(L, buffer, bsize);
+    buffer += len; bsize -= len;
+    if (eq) {
+      msgpack_view_push(L, anchor, buffer, bsize);
+      return 1;
+    }
+    len = msgpack_view_skip(L, buffer, bsize);
+    buffer += len; bsize -= len;
+  }
+  return 0;
+}
+
+/* `Array`与`Map`均返回元素数量 */
+static int msgpack_view_len(lua_State *L) {
+  msgpack_View *V = msgpack_view_check(L, 1);
+  lua_pushinteger(L, V->count);
+  return 1;
+}
+
+/* 迭代器的位置保存在上值中, 每次迭代只需要跳过上一个元素. */
+static int msgpack_view_next(lua_State *L) {
+  msgpack_View *V = msgpack_view_check(L, lua_upvalueindex(1));
+  size_t offset = lua_tointeger(L, lua_upvalueindex(2));
+  lua_Integer idx = lua_tointeger(L, lua_upvalueindex(3));
+  if ((uint64_t)idx >= V->count)
+    return 0;
+  lua_getuservalue(L, lua_upvalueindex(1));
+  int anchor = lua_gettop(L);
+  const char *buffer = V->data + offset; size_t bsize = V->size - offset;
+  size_t len;
+  if (V->kind == MSGPACK_KIND_ARRAY) {
+    lua_pushinteger(L, idx + 1);
+  } else {
+    len = msgpack_view_skip(L, buffer, bsize);
+    msgpack_view_push(L, anchor, buffer, bsize);
+    buffer += len; bsize -= len;
+  }
+  len = msgpack_view_skip(L, buffer, bsize);
+  msgpack_view_push(L, anchor, buffer, bsize);
+  buffer += len;
+  lua_pushinteger(L, buffer - V->data);
+  lua_replace(L, lua_upvalueindex(2));
+  lua_pushinteger(L, idx + 1);
+  lua_replace(L, lua_upvalueindex(3));
+  return 2;
+}
+
+static int msgpack_view_pairs(lua_State *L) {
+  msgpack_View *V = msgpack_view_check(L, 1);
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, V->hlen);
+  lua_pushinteger(L, 0);
+  lua_pushcclosure(L, msgpack_view_next, 3);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+/* 创建视图: msgpack.view(buffer [, pos]), 标量会被直接解码. */
+int lmsgpack_view(lua_State *L) {
+  size_t bsize;
+  const char *buffer = luaL_checklstring(L, 1, &bsize);
+  if (!buffer || bsize < 1)
+    return luaL_error(L, "[msgpack error]: decode buffer was empty");
+  size_t offset = msgpack_decode_pos(L, 2, bsize);
+  msgpack_view_push(L, 1, buffer + offset, bsize - offset);
+  return 1;
+}
+
+void msgpack_view_meta(lua_State *L) {
+  luaL_newmetatable(L, "lua_View");
+  lua_pushcfunction(L, msgpack_view_index);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, msgpack_view_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, msgpack_view_pairs);
+  lua_setfield(L, -2, "__pairs");
+  lua_pop(L, 1);
+}